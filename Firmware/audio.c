@@ -10,13 +10,36 @@
 #include "audio.h"
 #include "adc.h"
 #include "fx.h"
+#include "prof.h"
+#include "audio_out.h"
 
-uint64_t audio_duty, audio_period, audio_start_time, audio_prev_time;
+uint32_t audio_duty, audio_period;
 int16_t audio_sl[4], audio_len;
 volatile int16_t audio_mute_state, audio_mute_cnt;
-int16_t prc[2*BUFSZ];
-volatile uint8_t algo_chg_req, *algo_curr, algo_next;
-volatile uint8_t mute_chg_req, mute_next;
+uint32_t audio_frame_cnt;
+
+/* command ring - core 0 only writes head, the audio core only writes tail */
+audio_cmd audio_cmdq[AUDIO_CMDQ_LEN];
+volatile uint32_t audio_cmdq_head, audio_cmdq_tail;
+
+/*
+ * parking the audio core between blocks - the request goes through the
+ * command ring and the audio core acks it from its idle loop, so it's
+ * never stopped part way through a block
+ */
+#define AUDIO_PARK_TIMEOUT 100000	// us, many blocks at the longest size
+static uint8_t audio_park_pending;	// audio core only
+volatile uint8_t audio_parked, audio_unpark;
+
+/* loopback latency measurement */
+#define LAT_PULSE_LEN 4
+#define LAT_PULSE_AMP 0x60000000
+#define LAT_THRESH 0x10000000
+#define LAT_TIMEOUT (fx_sample_rate/2)
+#define LAT_DEADLINE 1000000	// us, core 0 gives up well after LAT_TIMEOUT
+volatile uint8_t audio_lat_state, audio_lat_id;
+volatile int32_t audio_lat_result;
+uint32_t audio_lat_tx;
 
 /*
  * init audio handler
@@ -28,239 +51,414 @@ void Audio_Init(void)
 	
 	/* init state */
 	audio_sl[0] = audio_sl[1] = audio_sl[2] = audio_sl[3] = 0;
-	audio_duty = audio_period = audio_start_time = audio_prev_time = 0;
+	audio_duty = audio_period = 0;
 	audio_mute_state = 2;	// start up  muted
 	audio_mute_cnt = 0;
-	algo_chg_req = 0;
-	mute_chg_req = 0;
+	audio_cmdq_head = audio_cmdq_tail = 0;
+	audio_frame_cnt = 0;
+	audio_lat_state = 0;
+	audio_park_pending = 0;
+	audio_parked = 0;
+	audio_unpark = 1;
 }
 
 /*
- * Request Algo change and block until complete - only used by core 0
+ * queue a command for the audio core - only used by core 0
+ * returns a sequence number for Audio_Cmd_Done()
  */
-void Audio_Set_Algo(uint8_t *curr_algo, uint8_t next_algo)
+static uint32_t Audio_Post(uint8_t cmd, uint8_t idx, int32_t val, void *ptr)
 {
-	/* wait for algo change to be available */
-	//printf("Audio_Set_Algo: next_algo = %d wait for algo_chg_req = %d\n", next_algo, 0);
-	while(algo_chg_req){}
+	uint32_t head = audio_cmdq_head;
+	audio_cmd *c = &audio_cmdq[head & (AUDIO_CMDQ_LEN-1)];
+	
+	/* only full if the audio core has stopped taking blocks */
+	while(head - audio_cmdq_tail >= AUDIO_CMDQ_LEN){}
 	
-	/* set up change request */
-	algo_curr = curr_algo;
-	algo_next = next_algo;
-	algo_chg_req = 1;
+	c->cmd = cmd;
+	c->idx = idx;
+	c->val = val;
+	c->ptr = ptr;
 	
-	/* wait for change to propagate */
-	//printf("Audio_Set_Algo: next_algo = %d wait for algo_chg_req = %d\n", next_algo, 2);
-	while(algo_chg_req != 2){}
+	/* entry must land before the audio core can see it */
+	__dmb();
+	audio_cmdq_head = head + 1;
 	
-	/* clear change request */
-	algo_chg_req = 0;
+	return head + 1;
 }
 
+/*
+ * check if a queued command has been applied
+ */
+uint8_t Audio_Cmd_Done(uint32_t seq)
+{
+	return (int32_t)(audio_cmdq_tail - seq) >= 0;
+}
 
 /*
- * Request mute on/off and block until complete
+ * Request Algo change - takes effect or starts crossfading at the next block
  */
-void Audio_Set_Mute(uint8_t enable)
+uint32_t Audio_Set_Algo(uint8_t algo, void *blk, uint8_t xfade)
 {
-	/* do nothing if already in desired state */
-	if(enable == audio_mute_state)
-		return;
-	
-	/* wait for mute change to be available */
-	//printf("Audio_Set_Mute: enable = %d wait for mute_chg_req = %d\n", enable, 0);
-	while(mute_chg_req){}
-	
-	/* set up change request */
-	mute_next = enable;
-	mute_chg_req = 1;
-	
-	/* wait for change to propagate */
-	//printf("Audio_Set_Mute: enable = %d wait for mute_chg_req = %d\n", enable, 2);
-	while(mute_chg_req != 2){}
-	
-	/* clear change request */
-	mute_chg_req = 0;
-	
-	/* block until mute change has finished */
-	//printf("Audio_Set_Mute: enable = %d wait for finish (current audio mute_state = %d)\n", enable, audio_mute_state);
+	return Audio_Post(AUDIO_CMD_ALGO, xfade, algo, blk);
+}
+
+/*
+ * Request mute on/off - the ramp starts at the next block
+ */
+uint32_t Audio_Set_Mute(uint8_t enable)
+{
+	return Audio_Post(AUDIO_CMD_MUTE, 0, enable, NULL);
+}
+
+/*
+ * block until a mute change has been applied and its ramp has finished
+ * for callers that are about to stop the audio
+ */
+void Audio_Wait_Mute(uint32_t seq)
+{
+	while(!Audio_Cmd_Done(seq)){}
 	while((audio_mute_state == 1) || (audio_mute_state == 3)){}
 }
 
 /*
- * disable core 1
+ * Request parameter value change - lands in order with other commands
+ */
+uint32_t Audio_Set_Param(uint8_t idx, int16_t val)
+{
+	return Audio_Post(AUDIO_CMD_PARAM, idx, val, NULL);
+}
+
+/*
+ * Request effect sample rate change - effects see it from the next block
+ * on, never part way through one
+ */
+uint32_t Audio_Set_Rate(uint32_t rate)
+{
+	return Audio_Post(AUDIO_CMD_RATE, 0, rate, NULL);
+}
+
+/*
+ * lock core 1 out for flash writes - returns 1 if it didn't respond
  */
-void Audio_Disable_Core(uint8_t disable)
+uint8_t Audio_Disable_Core(uint8_t disable)
 {
 	if(disable)
-	{
-		multicore_lockout_start_timeout_us(1000);
-	}
+		return multicore_lockout_start_timeout_us(1000) ? 0 : 1;
 	else
+		return multicore_lockout_end_timeout_us(1000) ? 0 : 1;
+}
+
+/*
+ * park the audio core between blocks or let it go again - only used by
+ * core 0. Returns 1 if it didn't park in time, in which case it's left
+ * running and the caller must not touch the audio buffers or effects.
+ */
+uint8_t Audio_Park(uint8_t park)
+{
+	uint32_t start;
+	
+	if(park)
 	{
-		multicore_lockout_end_timeout_us(1000);
+		audio_unpark = 0;
+		Audio_Post(AUDIO_CMD_PARK, 0, 0, NULL);
+		start = time_us_32();
+		while(!audio_parked)
+		{
+			if(time_us_32() - start > AUDIO_PARK_TIMEOUT)
+			{
+				/* a late ack sees this and carries straight on */
+				audio_unpark = 1;
+				return 1;
+			}
+		}
+		return 0;
 	}
+	
+	/* changes made while parked must land before it runs again */
+	__dmb();
+	audio_unpark = 1;
+	while(audio_parked){}
+	return 0;
 }
 
 /*
- * Audio foreground task - run by core 1
+ * called by the audio core between blocks - waits there while parked and
+ * returns 1 if it did
  */
-void Audio_Fore(void)
+uint8_t __not_in_flash_func(Audio_Park_Point)(void)
 {
-	uint32_t irqs;
+	if(!audio_park_pending)
+		return 0;
+	audio_park_pending = 0;
+	
+	if(audio_unpark)
+		return 0;
+	audio_parked = 1;
+	while(!audio_unpark){}
+	__dmb();
+	audio_parked = 0;
+	
+	return 1;
+}
 
-	/* handle algo change */
-	if(algo_chg_req == 1)
+/*
+ * Measure input to output latency in frames through an external loopback
+ * cable from output to input. Returns -1 if no pulse came back or the audio
+ * core isn't taking blocks (parked, held or stopped).
+ */
+int32_t Audio_Measure_Latency(void)
+{
+	uint32_t seq, start;
+	
+	/* a run given up on earlier may still be finishing on core 1 */
+	start = time_us_32();
+	while((audio_lat_state == 1) || (audio_lat_state == 2))
 	{
-		/* update value as requested */
-		*algo_curr = algo_next;
-		
-		/* advance state */
-		algo_chg_req = 2;
+		if(time_us_32() - start > LAT_DEADLINE)
+			return -1;
 	}
 	
-	/* handle mute change */
-	if(mute_chg_req == 1)
+	/* arm and wait for core 1 to emit the pulse and find or time out */
+	audio_lat_state = 0;
+	audio_lat_result = -1;
+	audio_lat_id++;
+	seq = Audio_Post(AUDIO_CMD_LAT, 0, audio_lat_id, NULL);
+	start = time_us_32();
+	while(!Audio_Cmd_Done(seq) || (audio_lat_state != 3))
 	{
-		if((audio_mute_state == 0) && (mute_next == 1))
+		if(time_us_32() - start > LAT_DEADLINE)
 		{
-			/* mute requested */			
-			audio_mute_cnt = 512;
-			audio_mute_state = 1;
-			
-			/* wait for mute to complete (is this needed?) */
-			//while(audio_mute_state != 2){}
+			/* if the request is still queued core 1 will skip it */
+			audio_lat_id++;
+			return -1;
 		}
-		else if((audio_mute_state == 2) && (mute_next == 0))
+	}
+	audio_lat_state = 0;
+	
+	return audio_lat_result;
+}
+
+/*
+ * apply queued commands - run by the audio core at the start of each block
+ */
+static void __not_in_flash_func(audio_cmd_run)(void)
+{
+	uint32_t tail = audio_cmdq_tail;
+	audio_cmd *c;
+	
+	while(tail != audio_cmdq_head)
+	{
+		/* don't read the entry before seeing the head that covers it */
+		__dmb();
+		c = &audio_cmdq[tail & (AUDIO_CMDQ_LEN-1)];
+		
+		switch(c->cmd)
 		{
-			/* unmute requested */
-			audio_mute_cnt = 0;
-			audio_mute_state = 3;
+			case AUDIO_CMD_ALGO:
+				fx_switch(c->val, c->ptr, c->idx);
+				break;
+			
+			case AUDIO_CMD_MUTE:
+				if((audio_mute_state == 0) && (c->val == 1))
+				{
+					/* mute requested */
+					audio_mute_cnt = 512;
+					audio_mute_state = 1;
+				}
+				else if((audio_mute_state == 2) && (c->val == 0))
+				{
+					/* unmute requested */
+					audio_mute_cnt = 0;
+					audio_mute_state = 3;
+				}
+				break;
+			
+			case AUDIO_CMD_PARAM:
+				ADC_setparamval(c->idx, c->val);
+				break;
+			
+			case AUDIO_CMD_LAT:
+				/* skip requests core 0 has already given up on */
+				if((uint8_t)c->val == audio_lat_id)
+					audio_lat_state = 1;
+				break;
 			
-			/* wait for unmute to complete (is this needed?) */
-			//while(audio_mute_state != 0){}
+			case AUDIO_CMD_RATE:
+				fx_set_rate(c->val);
+				break;
+			
+			case AUDIO_CMD_PARK:
+				/* finish this block first, Audio_Park_Point() stops after it */
+				audio_park_pending = 1;
+				break;
+			
+			default:
+				break;
 		}
 		
-		/* ack change req */
-		mute_chg_req = 2;
+		audio_cmdq_tail = ++tail;
 	}
 }
 
 /*
  * buffer math:
- * SMPS = 32 (same as stereo "FRAMES")
+ * SMPS = 32 (same as stereo "FRAMES") - this is the default, the actual
+ * block size is set at runtime from SMPS_MIN to SMPS_MAX
+ * by i2s_fulldup_set_frames()
  * CHLS = 2
  * BUFSZ = SMPS*CHLS = 64
- * FRAMES_PER_BUFFER = BUFSZ/2 = SMPS = 32 (in 32-bit words)
- * length(I2S inbuf) = FRAMES_PER_BUFFER * 2 = 64 total (both halves) but 32-bit words
- * length(src) = length(I2S inbuf/2) = SMPS = 32 in 32-bit words
+ * samples are 32-bit (24-bit left justified) so each frame is 2 words
+ * length(I2S inbuf) = BUFSZ * 2 = 128 words total (both halves)
+ * length(src) = length(I2S inbuf/2) = BUFSZ = 64 in 32-bit words
  * i iterations = SMPS = 32
  * src increments = i iterations * 2 = 64
+ *
+ * dst is the idle half of the I2S output buffer. The effect renders into it
+ * directly and the W/D mix is then done in place so there are no
+ * intermediate copies of the block.
  */
 
 /*
- * signal level calc
+ * latency measurement - look for returning pulse on input
  */
-void __not_in_flash_func(level_calc)(int16_t sig, uint16_t *level)
+void __not_in_flash_func(audio_lat_detect)(volatile int32_t *src, int32_t len)
 {
-	uint16_t rect;
-
-	/* rectify */
-	rect = (sig < 0) ? -sig : sig;
+	int32_t i;
+	
+	for(i=0;i<len;i++)
+	{
+		if((src[2*i] > LAT_THRESH) || (src[2*i] < -LAT_THRESH) ||
+			(src[2*i+1] > LAT_THRESH) || (src[2*i+1] < -LAT_THRESH))
+		{
+			audio_lat_result = audio_frame_cnt + i - audio_lat_tx;
+			audio_lat_state = 3;
+			return;
+		}
+	}
+	
+	if(audio_frame_cnt - audio_lat_tx > LAT_TIMEOUT)
+		audio_lat_state = 3;
+}
 
-	/* peak hold - externally reset */
-	if(*level < rect)
-		*level = rect;
+/*
+ * latency measurement - silence output and send pulse when armed
+ */
+void __not_in_flash_func(audio_lat_emit)(volatile int32_t *dst, int32_t len)
+{
+	int32_t i;
+	
+	for(i=0;i<2*len;i++)
+		dst[i] = 0;
+	
+	if(audio_lat_state == 1)
+	{
+		for(i=0;i<2*LAT_PULSE_LEN;i++)
+			dst[i] = LAT_PULSE_AMP;
+		audio_lat_tx = audio_frame_cnt;
+		audio_lat_state = 2;
+	}
 }
 
 /*
  * handle new buffer of ADC data
  */
-void __not_in_flash_func(Audio_Proc)(volatile int16_t *dst, volatile int16_t *src, int32_t len)
+void __not_in_flash_func(Audio_Proc)(volatile int32_t *dst, volatile int32_t *src, int32_t len)
 {
-	uint8_t i;
-	int32_t wet, dry, mix;
+	int32_t i, n, wet, dry;
+	uint32_t pk, t[PROF_NUM_STAGES+1];
 	
-	/* update start time for load calcs */
-	audio_prev_time = audio_start_time;
-	audio_start_time = time_us_64();
+	/* start of block timestamp for profiling and load calcs */
+	t[PROF_IN_LVL] = prof_now();
 	
 	len >>= 1;	// len input is total left + right ints - we need frames
 	audio_len = len;
 	
+	/* changes from core 0 land on block boundaries */
+	audio_cmd_run();
+	
+	/* look for returning latency pulse */
+	if(audio_lat_state == 2)
+		audio_lat_detect(src, len);
+	
 	/* check input levels */
+	pk = 0;
 	for(i=0;i<len;i++)
-	{
-		level_calc(src[2*i], &audio_sl[0]);
-		level_calc(src[2*i+1], &audio_sl[1]);
-	}
+		pk = audio_peak(pk, src[2*i], src[2*i+1]);
+	if((uint16_t)audio_sl[0] < (pk & 0xffff))
+		audio_sl[0] = pk & 0xffff;
+	if((uint16_t)audio_sl[1] < (pk >> 16))
+		audio_sl[1] = pk >> 16;
 	
-	/* process the selected algorithm */
-	fx_proc(prc, (int16_t *)src, len);
+	/* process the selected algorithm straight into the output buffer */
+	t[PROF_FX] = prof_now();
+	fx_proc((int32_t *)dst, (int32_t *)src, len);
 	
-	/* set W/D mix gain */	
+	/* W/D mix, muting and output metering in one kernel chosen for the block */
+	t[PROF_OUT] = prof_now();
+	audio_out_pk = 0;
 	wet = ADC_val[1];
 	dry = 0xfff - wet;
-	
-	/* handle output */
-	for(i=0;i<len;i++)
+	switch(audio_mute_state)
 	{
-		/* W/D with saturation */
-		mix = prc[2*i] * wet + src[2*i] * dry;
-		dst[2*i] = dsp_ssat16(mix>>12);
-		mix = prc[2*i+1] * wet + src[2*i+1] * dry;
-		dst[2*i+1] = dsp_ssat16(mix>>12);
+		case 1:
+			/* transition to mute state - rest of block is muted if it ends */
+			n = len < audio_mute_cnt ? len : audio_mute_cnt;
+			audio_out_ramp(dst, src, n, wet, dry, audio_mute_cnt, -1);
+			audio_mute_cnt -= n;
+			if(audio_mute_cnt == 0)
+			{
+				audio_mute_state = 2;
+				audio_out_zero(&dst[2*n], len-n);
+			}
+			break;
 		
-		/* handle muting */
-		switch(audio_mute_state)
-		{
-			case 0:
-				/* pass thru and wait for foreground to force a transition */
-				break;
-			
-			case 1:
-				/* transition to mute state */
-				mix = (dst[2*i] * audio_mute_cnt);
-				dst[2*i] = dsp_ssat16(mix>>9);
-				mix = (dst[2*i+1] * audio_mute_cnt);
-				dst[2*i+1] = dsp_ssat16(mix>>9);
-				audio_mute_cnt--;
-				if(audio_mute_cnt == 0)
-					audio_mute_state = 2;
-				break;
-				
-			case 2:
-				/* mute and wait for foreground to force a transition */
-				dst[2*i] = 0;
-				dst[2*i+1] = 0;
-				break;
-			
-			case 3:
-				/* transition to unmute state */
-				mix = (dst[2*i] * audio_mute_cnt);
-				dst[2*i] = dsp_ssat16(mix>>9);
-				mix = (dst[2*i+1] * audio_mute_cnt);
-				dst[2*i+1] = dsp_ssat16(mix>>9);
-				audio_mute_cnt++;
-				if(audio_mute_cnt == 512)
-				{
-					audio_mute_state = 0;
-					audio_mute_cnt = 0;
-				}
-				break;
-				
-			default:
-				/* go to legal state */
+		case 2:
+			/* mute and wait for foreground to force a transition */
+			audio_out_zero(dst, len);
+			break;
+		
+		case 3:
+			/* transition to unmute state - rest of block passes if it ends */
+			n = len < 512-audio_mute_cnt ? len : 512-audio_mute_cnt;
+			audio_out_ramp(dst, src, n, wet, dry, audio_mute_cnt, 1);
+			audio_mute_cnt += n;
+			if(audio_mute_cnt == 512)
+			{
 				audio_mute_state = 0;
-				break;
-		}
+				audio_mute_cnt = 0;
+				audio_out_pass(&dst[2*n], &src[2*n], len-n, wet, dry);
+			}
+			break;
+		
+		default:
+			/* go to legal state and fall thru */
+			audio_mute_state = 0;
+		
+		case 0:
+			/* pass thru and wait for foreground to force a transition */
+			audio_out_pass(dst, src, len, wet, dry);
+			break;
+	}
 	
-		/* check output levels */
-		level_calc(dst[2*i], &audio_sl[2]);
-		level_calc(dst[2*i+1], &audio_sl[3]);
+	/* latency measurement overrides output */
+	if((audio_lat_state == 1) || (audio_lat_state == 2))
+	{
+		audio_lat_emit(dst, len);
+		audio_out_pk = 0;
+		for(i=0;i<len;i++)
+			audio_out_pk = audio_peak(audio_out_pk, dst[2*i], dst[2*i+1]);
 	}
+	audio_frame_cnt += len;
+	
+	/* update output levels */
+	if((uint16_t)audio_sl[2] < (audio_out_pk & 0xffff))
+		audio_sl[2] = audio_out_pk & 0xffff;
+	if((uint16_t)audio_sl[3] < (audio_out_pk >> 16))
+		audio_sl[3] = audio_out_pk >> 16;
 	
-	/* update load calcs */
-	audio_period = audio_start_time - audio_prev_time;
-	audio_duty = time_us_64() - audio_start_time;
+	/* update profile and load calcs */
+	t[PROF_NUM_STAGES] = prof_now();
+	prof_block(t);
+	audio_period = prof_stats[PROF_PERIOD].last;
+	audio_duty = prof_stats[PROF_TOTAL].last;
 }
@@ -8,19 +8,50 @@
 
 #include "main.h"
 
-#define SMPS 32
+#define SMPS 32			// default frames per block
+#define SMPS_MIN 8		// block size is runtime selectable between these
+#define SMPS_MAX 128
 #define CHLS 2
 #define BUFSZ (SMPS*CHLS)
 
+#define AUDIO_CMDQ_LEN 32	// must be a power of 2
+
+/*
+ * commands from core 0 to the audio core
+ */
+enum audio_cmds
+{
+	AUDIO_CMD_ALGO,		// run algo val with state at ptr, idx = 1 to crossfade
+	AUDIO_CMD_MUTE,		// val = 1 to mute, 0 to unmute
+	AUDIO_CMD_PARAM,	// param idx = val
+	AUDIO_CMD_LAT,		// start a latency measurement
+	AUDIO_CMD_PARK,		// stop between blocks until Audio_Park(0)
+	AUDIO_CMD_RATE,		// effects run at sample rate val from this block on
+};
+
+typedef struct
+{
+	uint8_t cmd;
+	uint8_t idx;
+	int32_t val;
+	void *ptr;
+} audio_cmd;
+
 extern int16_t audio_sl[4], audio_len;
-extern uint64_t audio_duty, audio_period;
+extern uint32_t audio_duty, audio_period;
 
 void Audio_Init(void);
-void Audio_Set_Algo(uint8_t *curr_algo, uint8_t next_algo);
-void Audio_Set_Mute(uint8_t enable);
-void Audio_Disable_Core(uint8_t disable);
-void Audio_Fore(void);
-void Audio_Proc(volatile int16_t *dst, volatile int16_t *src, int32_t sz);
+uint8_t Audio_Cmd_Done(uint32_t seq);
+uint32_t Audio_Set_Algo(uint8_t algo, void *blk, uint8_t xfade);
+uint32_t Audio_Set_Mute(uint8_t enable);
+void Audio_Wait_Mute(uint32_t seq);
+uint32_t Audio_Set_Param(uint8_t idx, int16_t val);
+uint32_t Audio_Set_Rate(uint32_t rate);
+uint8_t Audio_Disable_Core(uint8_t disable);
+uint8_t Audio_Park(uint8_t park);
+uint8_t Audio_Park_Point(void);
+int32_t Audio_Measure_Latency(void);
+void Audio_Proc(volatile int32_t *dst, volatile int32_t *src, int32_t sz);
 
 #endif
 
@@ -0,0 +1,105 @@
+/*
+ * audio_out.c - output kernels for rp2040_audio
+ * 10-17-26 E. Brombaugh
+ *
+ * Kept apart from Audio_Proc so the host build can check them.
+ */
+
+#include "audio_out.h"
+
+uint32_t audio_out_pk;
+
+/*
+ * muted - silence is below any held peak so there's nothing to meter
+ */
+void __not_in_flash_func(audio_out_zero)(volatile int32_t *dst, int32_t len)
+{
+	int32_t *d = (int32_t *)dst;
+	int32_t i;
+	
+	for(i=0;i<2*len;i++)
+		d[i] = 0;
+}
+
+/*
+ * unmuted with both wet and dry
+ */
+static void __not_in_flash_func(audio_out_mix)(int32_t *dst, int32_t *src,
+	int32_t len, int32_t wet, int32_t dry)
+{
+	uint32_t pk = audio_out_pk;
+	int32_t i, l, r;
+	
+	for(i=0;i<len;i++)
+	{
+		l = dsp_mix32(dst[2*i], wet, src[2*i], dry, 12);
+		r = dsp_mix32(dst[2*i+1], wet, src[2*i+1], dry, 12);
+		dst[2*i] = l;
+		dst[2*i+1] = r;
+		pk = audio_peak(pk, l, r);
+	}
+	
+	audio_out_pk = pk;
+}
+
+/*
+ * unmuted fully wet or fully dry - one gain per sample from either the
+ * effect output or the input
+ */
+static void __not_in_flash_func(audio_out_one)(int32_t *dst, int32_t *src,
+	int32_t len)
+{
+	uint32_t pk = audio_out_pk;
+	int32_t i, l, r;
+	
+	for(i=0;i<len;i++)
+	{
+		l = dsp_mul32(src[2*i], 0xfff, 12);
+		r = dsp_mul32(src[2*i+1], 0xfff, 12);
+		dst[2*i] = l;
+		dst[2*i+1] = r;
+		pk = audio_peak(pk, l, r);
+	}
+	
+	audio_out_pk = pk;
+}
+
+/*
+ * unmuted - pick the cheapest mix for the W/D setting
+ */
+void __not_in_flash_func(audio_out_pass)(volatile int32_t *dst,
+	volatile int32_t *src, int32_t len, int32_t wet, int32_t dry)
+{
+	if(dry == 0)
+		audio_out_one((int32_t *)dst, (int32_t *)dst, len);
+	else if(wet == 0)
+		audio_out_one((int32_t *)dst, (int32_t *)src, len);
+	else
+		audio_out_mix((int32_t *)dst, (int32_t *)src, len, wet, dry);
+}
+
+/*
+ * mute / unmute ramp - gain steps by dir each frame starting at cnt
+ */
+void __not_in_flash_func(audio_out_ramp)(volatile int32_t *dst,
+	volatile int32_t *src, int32_t len, int32_t wet, int32_t dry,
+	int32_t cnt, int32_t dir)
+{
+	int32_t *d = (int32_t *)dst, *s = (int32_t *)src;
+	uint32_t pk = audio_out_pk;
+	int32_t i, l, r;
+	
+	for(i=0;i<len;i++)
+	{
+		l = dsp_mix32(d[2*i], wet, s[2*i], dry, 12);
+		r = dsp_mix32(d[2*i+1], wet, s[2*i+1], dry, 12);
+		l = dsp_mul32(l, cnt, 9);
+		r = dsp_mul32(r, cnt, 9);
+		d[2*i] = l;
+		d[2*i+1] = r;
+		pk = audio_peak(pk, l, r);
+		cnt += dir;
+	}
+	
+	audio_out_pk = pk;
+}
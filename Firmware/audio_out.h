@@ -0,0 +1,37 @@
+/*
+ * audio_out.h - output kernels for rp2040_audio
+ * 10-17-26 E. Brombaugh
+ */
+
+#ifndef __audio_out__
+#define __audio_out__
+
+#include "main.h"
+#include "dsp_lib.h"
+
+/*
+ * Output kernels:
+ * W/D mix, mute ramp and output peak metering fused into one pass over the
+ * block, with the variant picked once per block instead of per sample.
+ * wet + dry is always 0xfff so the mix can't overflow and the ramp gain is
+ * at most 1.0 - no saturation is needed anywhere. Peaks of the top 16 bits
+ * collect packed in audio_out_pk and are applied to audio_sl[] once per
+ * block.
+ */
+extern uint32_t audio_out_pk;
+
+/*
+ * peak of the top 16 bits of a frame
+ */
+static inline uint32_t audio_peak(uint32_t pk, int32_t l, int32_t r)
+{
+	return dsp_st_peak(pk, dsp_st_pack(l >> 16, r >> 16));
+}
+
+void audio_out_zero(volatile int32_t *dst, int32_t len);
+void audio_out_pass(volatile int32_t *dst, volatile int32_t *src, int32_t len,
+	int32_t wet, int32_t dry);
+void audio_out_ramp(volatile int32_t *dst, volatile int32_t *src, int32_t len,
+	int32_t wet, int32_t dry, int32_t cnt, int32_t dir);
+
+#endif
@@ -0,0 +1,472 @@
+/*
+ * bench.c - cycle benchmarks of the DSP kernels and effects
+ * 10-17-26 E. Brombaugh
+ *
+ * Times every dsp_lib primitive, the circbuf ops, the oversampling filters
+ * and each registered effect over blocks of BENCH_SIZES frames and prints
+ * CSV so runs from two commits can be diffed. On target each block is timed
+ * with SysTick on core 0 while the audio core is parked between blocks and
+ * the output silent, giving cycles per stereo frame. Effects run as their
+ * own instances straight from init, so the live one is never touched. On
+ * the host batches of blocks are timed with the monotonic clock, giving ns
+ * per frame, throughput and cost relative to a plain copy.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "bench.h"
+#include "fx.h"
+#include "audio.h"
+#include "circbuf.h"
+#include "dsp_interp.h"
+#include "dsp_os.h"
+#include "prof.h"
+#include "hardware/clocks.h"
+#if PICO_ON_DEVICE
+#include "i2s_fulldup.h"
+#else
+#include <time.h>
+#endif
+
+#define BENCH_NUM_SIZES 3
+#define BENCH_RING_BITS 8		// interp ring frames
+#define BENCH_CIRC_LEN 256		// circbuf samples
+
+#if PICO_ON_DEVICE
+#define BENCH_BATCH 1			// blocks per timing
+#define BENCH_SAMPLES 64		// timings per result, the minimum is reported
+typedef uint32_t bench_t;
+#else
+#define BENCH_BATCH 256
+#define BENCH_SAMPLES 32
+typedef uint64_t bench_t;
+#endif
+
+const uint16_t bench_sizes[BENCH_NUM_SIZES] =
+{
+	SMPS_MIN,
+	32,
+	SMPS_MAX,
+};
+
+typedef struct
+{
+	const char *name;
+	void (*run)(uint16_t sz);
+} bench_item;
+
+/* work buffers, only allocated while running */
+static int32_t *bench_in, *bench_out;
+static uint32_t *bench_pk, *bench_ring;
+static int16_t *bench_circ;
+static circbuf_int16_t bench_cb;
+static volatile uint32_t bench_sink;
+
+/*
+ * timer - SysTick counts down and wraps at 24 bits
+ */
+static inline bench_t bench_now(void)
+{
+#if PICO_ON_DEVICE
+	return prof_now();
+#else
+	struct timespec ts;
+	
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+}
+
+static inline bench_t bench_diff(bench_t start, bench_t end)
+{
+#if PICO_ON_DEVICE
+	return (start - end) & PROF_MASK;
+#else
+	return end - start;
+#endif
+}
+
+/**************************************************************************/
+/******************* kernels - sz stereo frames each **********************/
+/**************************************************************************/
+
+static void __not_in_flash_func(bench_copy)(uint16_t sz)
+{
+	uint16_t i;
+	
+	for(i=0;i<2*sz;i++)
+		bench_out[i] = bench_in[i];
+}
+
+static void __not_in_flash_func(bench_ssat16)(uint16_t sz)
+{
+	int16_t *d = (int16_t *)bench_out;
+	uint16_t i;
+	
+	for(i=0;i<2*sz;i++)
+		d[i] = dsp_ssat16(bench_in[i] >> 14);
+}
+
+static void __not_in_flash_func(bench_mul32)(uint16_t sz)
+{
+	uint16_t i;
+	
+	for(i=0;i<2*sz;i++)
+		bench_out[i] = dsp_mul32(bench_in[i], 3000, 12);
+}
+
+static void __not_in_flash_func(bench_mix32)(uint16_t sz)
+{
+	uint16_t i;
+	
+	for(i=0;i<2*sz;i++)
+		bench_out[i] = dsp_mix32(bench_in[i], 3000, bench_out[i], 1095, 12);
+}
+
+static void __not_in_flash_func(bench_st_pack_ssat)(uint16_t sz)
+{
+	uint16_t i;
+	
+	for(i=0;i<sz;i++)
+		bench_pk[i] = dsp_st_pack_ssat(bench_in[2*i] >> 14, bench_in[2*i+1] >> 14);
+}
+
+static void __not_in_flash_func(bench_st_gain)(uint16_t sz)
+{
+	uint16_t i;
+	
+	for(i=0;i<sz;i++)
+		bench_pk[i] = dsp_st_gain(bench_pk[i], 3000, 12);
+}
+
+static void __not_in_flash_func(bench_st_mix)(uint16_t sz)
+{
+	uint16_t i;
+	
+	for(i=0;i<sz;i++)
+		bench_pk[i] = dsp_st_mix(bench_pk[i], 3000, bench_in[i], 1095, 12);
+}
+
+static void __not_in_flash_func(bench_st_peak)(uint16_t sz)
+{
+	uint32_t pk = 0;
+	uint16_t i;
+	
+	for(i=0;i<sz;i++)
+		pk = dsp_st_peak(pk, bench_pk[i]);
+	bench_sink = pk;
+}
+
+static void __not_in_flash_func(bench_gethyst)(uint16_t sz)
+{
+	int16_t old = 0;
+	uint16_t i;
+	
+	for(i=0;i<sz;i++)
+		bench_sink += dsp_gethyst(&old, bench_in[i] >> 20);
+}
+
+static void __not_in_flash_func(bench_ratio_hyst)(uint16_t sz)
+{
+	uint16_t old = 0;
+	uint16_t i;
+	
+	for(i=0;i<sz;i++)
+		bench_sink += dsp_ratio_hyst_arb(&old, (bench_in[i] >> 20) & 0xfff, 7);
+}
+
+static void __not_in_flash_func(bench_interp_blend)(uint16_t sz)
+{
+	uint16_t i;
+	
+	dsp_interp_blend_init();
+	dsp_interp_blend_alpha(100);
+	for(i=0;i<2*sz;i++)
+		bench_out[i] = dsp_interp_blend(bench_in[i] >> 8, bench_out[i] >> 8);
+}
+
+static void __not_in_flash_func(bench_interp_ring)(uint16_t sz)
+{
+	uint16_t i;
+	
+	dsp_interp_ring_init(bench_ring, BENCH_RING_BITS, bench_sink, bench_sink - 100);
+	for(i=0;i<sz;i++)
+	{
+		*dsp_interp_ring_wr() = bench_pk[i];
+		bench_pk[i] = *dsp_interp_ring_rd();
+		dsp_interp_ring_step();
+	}
+	bench_sink = dsp_interp_ring_widx();
+}
+
+static void __not_in_flash_func(bench_circ_put)(uint16_t sz)
+{
+	uint16_t i;
+	
+	for(i=0;i<2*sz;i++)
+		put_circbuf_int16_t(&bench_cb, bench_in[i] >> 16);
+}
+
+static void __not_in_flash_func(bench_circ_get)(uint16_t sz)
+{
+	int32_t sum = 0;
+	uint16_t i;
+	
+	for(i=0;i<2*sz;i++)
+		sum += get_circbuf_int16_t(&bench_cb, i);
+	bench_sink = sum;
+}
+
+static void __not_in_flash_func(bench_circ_set)(uint16_t sz)
+{
+	uint16_t i;
+	
+	for(i=0;i<2*sz;i++)
+		set_circbuf_int16_t(&bench_cb, bench_in[i] >> 16, i);
+}
+
+static dsp_os_state *bench_os;
+static int32_t *bench_lo;
+
+/* oversampling with a pass through kernel - just the filters */
+static int32_t __not_in_flash_func(bench_os_pass)(void *ctx, uint8_t ch, int32_t x)
+{
+	return x;
+}
+
+static void __not_in_flash_func(bench_os2)(uint16_t sz)
+{
+	bench_os->factor = 2;
+	dsp_os_proc(bench_os, bench_os_pass, NULL, bench_out, bench_in, sz);
+}
+
+static void __not_in_flash_func(bench_os4)(uint16_t sz)
+{
+	bench_os->factor = 4;
+	dsp_os_proc(bench_os, bench_os_pass, NULL, bench_out, bench_in, sz);
+}
+
+/* down to a slow section and straight back up */
+static void __not_in_flash_func(bench_mr2)(uint16_t sz)
+{
+	bench_os->factor = 2;
+	dsp_os_decimate(bench_os, bench_lo, bench_in, sz);
+	dsp_os_interpolate(bench_os, bench_out, bench_lo, sz);
+}
+
+static void __not_in_flash_func(bench_mr4)(uint16_t sz)
+{
+	bench_os->factor = 4;
+	dsp_os_decimate(bench_os, bench_lo, bench_in, sz);
+	dsp_os_interpolate(bench_os, bench_out, bench_lo, sz);
+}
+
+/* copy first - the host reports everything relative to it */
+const bench_item bench_kernels[] =
+{
+	{"copy",				bench_copy},
+	{"dsp_ssat16",			bench_ssat16},
+	{"dsp_mul32",			bench_mul32},
+	{"dsp_mix32",			bench_mix32},
+	{"dsp_st_pack_ssat",	bench_st_pack_ssat},
+	{"dsp_st_gain",			bench_st_gain},
+	{"dsp_st_mix",			bench_st_mix},
+	{"dsp_st_peak",			bench_st_peak},
+	{"dsp_gethyst",			bench_gethyst},
+	{"dsp_ratio_hyst_arb",	bench_ratio_hyst},
+	{"dsp_interp_blend",	bench_interp_blend},
+	{"dsp_interp_ring",		bench_interp_ring},
+	{"put_circbuf",			bench_circ_put},
+	{"get_circbuf",			bench_circ_get},
+	{"set_circbuf",			bench_circ_set},
+	{"dsp_os_2x",			bench_os2},
+	{"dsp_os_4x",			bench_os4},
+	{"dsp_os_half",			bench_mr2},
+	{"dsp_os_quarter",		bench_mr4},
+};
+
+#define BENCH_NUM_KERNELS (sizeof(bench_kernels)/sizeof(bench_item))
+
+/* effect under test and its detached instance */
+static uint8_t bench_algo;
+static void *bench_blk;
+
+static void __not_in_flash_func(bench_effect)(uint16_t sz)
+{
+	fx_run_effect(effects[bench_algo], bench_blk, bench_out, bench_in, sz);
+}
+
+/**************************************************************************/
+/******************* harness **********************************************/
+/**************************************************************************/
+
+/* copy time per frame at each size, for the host's relative cost */
+static uint64_t bench_base[BENCH_NUM_SIZES];
+
+/*
+ * time one kernel at each block size and print a line per size
+ */
+static void bench_item_run(const char *kind, const char *name,
+	void (*run)(uint16_t sz))
+{
+	bench_t t, best, sum;
+	uint16_t s, j, k, sz;
+	
+	for(s=0;s<BENCH_NUM_SIZES;s++)
+	{
+		sz = bench_sizes[s];
+		
+		/* one untimed pass to warm up state and caches */
+		run(sz);
+		best = ~(bench_t)0;
+		sum = 0;
+		for(j=0;j<BENCH_SAMPLES;j++)
+		{
+			t = bench_now();
+			for(k=0;k<BENCH_BATCH;k++)
+				run(sz);
+			t = bench_diff(t, bench_now());
+			best = t < best ? t : best;
+			sum += t;
+		}
+		
+#if PICO_ON_DEVICE
+		/* cycles per frame to 0.1 */
+		best = best * 10 / sz;
+		sum = sum * 10 / (sz * BENCH_SAMPLES);
+		printf("%s,%s,%d,%u.%u,%u.%u\n", kind, name, sz, best/10, best%10,
+			sum/10, sum%10);
+#else
+		/* ns per frame in 1/1000 */
+		best = best * 1000 / ((uint64_t)sz * BENCH_BATCH);
+		if(run == bench_copy)
+			bench_base[s] = best ? best : 1;
+		printf("%s,%s,%d,%.3f,%.0f,%.2f\n", kind, name, sz, best / 1000.0,
+			best ? 1e12 / best : 0, (double)best / bench_base[s]);
+#endif
+	}
+}
+
+/*
+ * park the audio core between blocks so it doesn't share the bus, with the
+ * output silent while it's stopped
+ */
+static void bench_hold(uint8_t hold)
+{
+#if PICO_ON_DEVICE
+	i2s_fulldup_hold(hold);
+#endif
+}
+
+/*
+ * xruns so far - none on the host
+ */
+static uint32_t bench_xruns(void)
+{
+#if PICO_ON_DEVICE
+	return i2s_fulldup_get_xruns(NULL);
+#else
+	return 0;
+#endif
+}
+
+/*
+ * run everything
+ */
+void bench_run(void)
+{
+	int16_t parm[FX_MAX_PARAMS+1];
+	uint8_t prev_algo = fx_get_algo();
+	uint16_t prev_xfade = fx_get_xfade();
+	uint32_t i, rnd = 0x12345678, xruns;
+	
+	bench_in = malloc(2*SMPS_MAX*sizeof(int32_t));
+	bench_out = malloc(2*SMPS_MAX*sizeof(int32_t));
+	bench_pk = malloc(SMPS_MAX*sizeof(uint32_t));
+	bench_ring = malloc((1<<BENCH_RING_BITS)*sizeof(uint32_t));
+	bench_circ = malloc(BENCH_CIRC_LEN*sizeof(int16_t));
+	bench_os = malloc(sizeof(dsp_os_state));
+	bench_lo = malloc(2*DSP_OS_SLOW_MAX(SMPS_MAX)*sizeof(int32_t));
+	if(!bench_in || !bench_out || !bench_pk || !bench_ring || !bench_circ || !bench_os ||
+		!bench_lo)
+	{
+		printf("bench_run: no memory for buffers\n");
+		goto done;
+	}
+	
+	/* noise in and a cleared ring */
+	for(i=0;i<2*SMPS_MAX;i++)
+	{
+		rnd ^= rnd << 13;
+		rnd ^= rnd >> 17;
+		rnd ^= rnd << 5;
+		bench_in[i] = rnd & ~0xff;
+		bench_out[i] = 0;
+	}
+	for(i=0;i<SMPS_MAX;i++)
+		bench_pk[i] = bench_in[i];
+	for(i=0;i<(1<<BENCH_RING_BITS);i++)
+		bench_ring[i] = 0;
+	init_circbuf_int16_t(&bench_cb, bench_circ, BENCH_CIRC_LEN);
+	dsp_os_init(bench_os, 2);
+	
+#if PICO_ON_DEVICE
+	/* SysTick on this core */
+	prof_start();
+	printf("# bench target clk_sys=%u rate=%u\n", clock_get_hz(clk_sys), fx_sample_rate);
+	printf("kind,name,frames,cyc_frame_min,cyc_frame_mean\n");
+#else
+	printf("# bench host rate=%u\n", fx_sample_rate);
+	printf("kind,name,frames,ns_frame,frames_s,rel_copy\n");
+#endif
+	
+	xruns = bench_xruns();
+	bench_hold(1);
+	for(i=0;i<BENCH_NUM_KERNELS;i++)
+		bench_item_run("dsp", bench_kernels[i].name, bench_kernels[i].run);
+	bench_hold(0);
+	
+	/*
+	 * effects at mid params, each a new instance beside bypass so there's
+	 * room for the biggest - the one that was running is reloaded after
+	 */
+	for(i=1;i<=FX_MAX_PARAMS;i++)
+	{
+		parm[i] = ADC_param[i];
+		ADC_param[i] = 0x800;
+	}
+	fx_set_xfade(0);
+	fx_select_algo(FX_ALGO_fx_bypass_struct);
+	fx_cache_flush();
+	for(bench_algo=0;bench_algo<FX_NUM_ALGOS;bench_algo++)
+	{
+		if(fx_load_detached(bench_algo, &bench_blk))
+		{
+			printf("# %s doesn't fit beside bypass\n", effects[bench_algo]->name);
+			continue;
+		}
+		
+		bench_hold(1);
+		bench_item_run("fx", effects[bench_algo]->name, bench_effect);
+		bench_hold(0);
+		fx_drop_detached();
+	}
+	fx_select_algo(prev_algo);
+	fx_set_xfade(prev_xfade);
+	for(i=1;i<=FX_MAX_PARAMS;i++)
+		ADC_param[i] = parm[i];
+	
+	/* the log is left as it was, anything new happened during the run */
+	xruns = bench_xruns() - xruns;
+	if(xruns)
+		printf("# %u xruns during bench - see x\n", xruns);
+	
+done:
+	free(bench_in);
+	free(bench_out);
+	free(bench_pk);
+	free(bench_ring);
+	free(bench_circ);
+	free(bench_os);
+	free(bench_lo);
+}
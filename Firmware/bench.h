@@ -0,0 +1,13 @@
+/*
+ * bench.h - cycle benchmarks of the DSP kernels and effects
+ * 10-17-26 E. Brombaugh
+ */
+
+#ifndef __bench__
+#define __bench__
+
+#include "main.h"
+
+void bench_run(void);
+
+#endif
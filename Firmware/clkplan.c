@@ -0,0 +1,215 @@
+/*
+ * clkplan.c - system clock planner for exact audio clocks
+ * 10-17-26 E. Brombaugh
+ *
+ * MCLK comes from a GPOUT integer divide of clk_sys and the PIO runs at
+ * the same rate, so the audio clocks are only as good as clk_sys is a
+ * multiple of 256fs. For each rate this searches the sys PLL settings in
+ * the window of the selected profile for the one closest to an integer
+ * multiple, preferring the fastest clock when several are equally close.
+ * clk_peri is moved to the USB PLL so the UART, SPI and I2C rates don't
+ * move when clk_sys does.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "hardware/clocks.h"
+#include "hardware/pll.h"
+#include "hardware/vreg.h"
+#include "clkplan.h"
+
+#define CLKPLAN_XOSC_HZ 12000000
+#define CLKPLAN_VCO_MIN 750000000
+#define CLKPLAN_VCO_MAX 1600000000
+
+const clkplan_profile clkplan_profiles[CLKPLAN_NUM_PROFILES] =
+{
+	{"std",   100000, 133000, VREG_VOLTAGE_1_10},
+	{"oc240", 200000, 240000, VREG_VOLTAGE_1_15},
+	{"oc270", 240000, 270000, VREG_VOLTAGE_1_20},
+};
+
+const uint32_t clkplan_rates[CLKPLAN_NUM_RATES] =
+{
+	32000,
+	44100,
+	48000,
+	96000,
+};
+
+static uint8_t clkplan_profile_sel;
+static clkplan_entry clkplan_cur;
+static uint8_t clkplan_vreg;
+
+/*
+ * keep the peripherals on the fixed 48MHz USB PLL
+ */
+static void clkplan_peri(void)
+{
+	clock_configure(clk_peri, 0, CLOCKS_CLK_PERI_CTRL_AUXSRC_VALUE_CLKSRC_PLL_USB,
+		48*MHZ, 48*MHZ);
+}
+
+/*
+ * init the planner - call before stdio is started
+ */
+void clkplan_init(void)
+{
+	clkplan_profile_sel = CLKPLAN_PROFILE;
+	clkplan_cur.vco_hz = 0;
+	clkplan_vreg = VREG_VOLTAGE_DEFAULT;
+	clkplan_peri();
+}
+
+/*
+ * search the PLL settings in a profile for the best clk_sys for a rate
+ * returns 0 if a plan was found
+ */
+uint8_t clkplan_find(uint8_t profile, uint32_t rate, clkplan_entry *plan)
+{
+	const clkplan_profile *prof = &clkplan_profiles[profile];
+	uint32_t fbdiv, pd1, pd2, pd, vco, mdiv, err, best_err = 0xffffffff;
+	uint64_t mclk, best_sys = 0, sys;
+	int64_t diff;
+	
+	for(fbdiv=16;fbdiv<=320;fbdiv++)
+	{
+		vco = CLKPLAN_XOSC_HZ*fbdiv;
+		if((vco < CLKPLAN_VCO_MIN) || (vco > CLKPLAN_VCO_MAX))
+			continue;
+		
+		for(pd1=1;pd1<=7;pd1++)
+		{
+			for(pd2=1;pd2<=pd1;pd2++)
+			{
+				/* clk_sys = vco/pd may not be an integer so scale the window */
+				pd = pd1*pd2;
+				if(((uint64_t)vco < (uint64_t)prof->min_khz*1000*pd) ||
+					((uint64_t)vco > (uint64_t)prof->max_khz*1000*pd))
+					continue;
+				
+				/* nearest integer MCLK divide and the rate error it leaves */
+				mclk = (uint64_t)256*rate*pd;
+				mdiv = (vco + mclk/2)/mclk;
+				diff = (int64_t)vco - (int64_t)(mdiv*mclk);
+				diff = diff*1000000000/(int64_t)(mdiv*mclk);
+				
+				/* closest to the nearest ppm, then fastest */
+				err = llabs(diff)/1000;
+				sys = (uint64_t)vco*1000/pd;
+				if((err < best_err) || ((err == best_err) && (sys > best_sys)))
+				{
+					best_err = err;
+					best_sys = sys;
+					plan->rate = rate;
+					plan->vco_hz = vco;
+					plan->fbdiv = fbdiv;
+					plan->pd1 = pd1;
+					plan->pd2 = pd2;
+					plan->mdiv = mdiv;
+					plan->err_ppb = diff;
+				}
+			}
+		}
+	}
+	
+	return best_err == 0xffffffff;
+}
+
+/*
+ * position of a rate in clkplan_rates, CLKPLAN_NUM_RATES if unsupported
+ */
+uint8_t clkplan_rate_index(uint32_t rate)
+{
+	uint8_t i;
+	
+	for(i=0;i<CLKPLAN_NUM_RATES;i++)
+		if(clkplan_rates[i] == rate)
+			break;
+	
+	return i;
+}
+
+/*
+ * move clk_sys to the plan for a rate in the current profile
+ * returns the plan or NULL if clk_sys was left alone
+ */
+const clkplan_entry *clkplan_set_rate(uint32_t rate)
+{
+	clkplan_entry plan;
+	uint8_t vreg = clkplan_profiles[clkplan_profile_sel].vreg;
+	
+	if(clkplan_find(clkplan_profile_sel, rate, &plan))
+		return NULL;
+	
+	if((plan.vco_hz != clkplan_cur.vco_hz) || (plan.pd1 != clkplan_cur.pd1) ||
+		(plan.pd2 != clkplan_cur.pd2))
+	{
+		/* raise the core voltage before speeding up */
+		if(vreg > clkplan_vreg)
+		{
+			vreg_set_voltage(vreg);
+			sleep_ms(10);
+		}
+		
+		set_sys_clock_pll(plan.vco_hz, plan.pd1, plan.pd2);
+		clkplan_peri();
+		
+		/* and lower it after slowing down */
+		if(vreg < clkplan_vreg)
+			vreg_set_voltage(vreg);
+		clkplan_vreg = vreg;
+	}
+	
+	clkplan_cur = plan;
+	return &clkplan_cur;
+}
+
+/*
+ * get the current clock profile
+ */
+uint8_t clkplan_get_profile(void)
+{
+	return clkplan_profile_sel;
+}
+
+/*
+ * select the clock profile - applied by the next clkplan_set_rate()
+ */
+uint8_t clkplan_set_profile(uint8_t profile)
+{
+	if(profile > CLKPLAN_MAX_PROFILE)
+		return 1;
+	
+	clkplan_profile_sel = profile;
+	return 0;
+}
+
+/*
+ * print the plan for every rate in the current profile
+ */
+void clkplan_report(uint16_t frames)
+{
+	clkplan_entry plan;
+	uint32_t sys, cycles, err;
+	int32_t extra;
+	uint8_t i;
+	
+	printf("Clock profile %s, clk_sys %u Hz\n",
+		clkplan_profiles[clkplan_profile_sel].name, clock_get_hz(clk_sys));
+	printf("  Rate     clk_sys fbdiv post MCLK/   err ppm  cyc/blk   extra\n");
+	for(i=0;i<CLKPLAN_NUM_RATES;i++)
+	{
+		if(clkplan_find(clkplan_profile_sel, clkplan_rates[i], &plan))
+			continue;
+		
+		sys = plan.vco_hz/(plan.pd1*plan.pd2);
+		cycles = (uint64_t)sys*frames/plan.rate;
+		extra = cycles - (int32_t)((uint64_t)CLKPLAN_BASE_HZ*frames/plan.rate);
+		err = abs(plan.err_ppb);
+		printf(" %5u %11u   %3u  %ux%u  %4u  %c%4u.%03u  %7u  %+6d%s\n",
+			plan.rate, sys, plan.fbdiv, plan.pd1, plan.pd2, plan.mdiv,
+			plan.err_ppb < 0 ? '-' : '+', err/1000, err%1000,
+			cycles, extra, plan.rate == clkplan_cur.rate ? " <" : "");
+	}
+}
@@ -0,0 +1,68 @@
+/*
+ * clkplan.h - system clock planner for exact audio clocks
+ * 10-17-26 E. Brombaugh
+ */
+
+#ifndef __clkplan__
+#define __clkplan__
+
+#include "main.h"
+
+/*
+ * clock profiles - overclocked ones raise the core voltage
+ */
+enum clkplan_profiles
+{
+	CLKPLAN_STD,		// 100-133MHz at the default 1.10V
+	CLKPLAN_OC240,		// 200-240MHz at 1.15V
+	CLKPLAN_OC270,		// 240-270MHz at 1.20V - needs flash SPI clkdiv 4
+	CLKPLAN_NUM_PROFILES
+};
+
+/* profile used at startup */
+#ifndef CLKPLAN_PROFILE
+#define CLKPLAN_PROFILE CLKPLAN_STD
+#endif
+
+/* highest profile that may be selected - see CMakeLists.txt for OC270 */
+#ifndef CLKPLAN_MAX_PROFILE
+#define CLKPLAN_MAX_PROFILE CLKPLAN_OC240
+#endif
+
+/* sample rates the codec supports, in the order the console steps them */
+#define CLKPLAN_NUM_RATES 4
+
+/* default clk_sys that cycle gains are measured against */
+#define CLKPLAN_BASE_HZ 125000000
+
+typedef struct
+{
+	const char *name;
+	uint32_t min_khz;
+	uint32_t max_khz;
+	uint8_t vreg;		// enum vreg_voltage
+} clkplan_profile;
+
+typedef struct
+{
+	uint32_t rate;		// target sample rate
+	uint32_t vco_hz;
+	uint16_t fbdiv;
+	uint8_t pd1;
+	uint8_t pd2;
+	uint16_t mdiv;		// clk_sys / MCLK, MCLK = 256fs
+	int32_t err_ppb;	// achieved rate error in parts per billion
+} clkplan_entry;
+
+extern const clkplan_profile clkplan_profiles[CLKPLAN_NUM_PROFILES];
+extern const uint32_t clkplan_rates[CLKPLAN_NUM_RATES];
+
+void clkplan_init(void);
+uint8_t clkplan_find(uint8_t profile, uint32_t rate, clkplan_entry *plan);
+uint8_t clkplan_rate_index(uint32_t rate);
+const clkplan_entry *clkplan_set_rate(uint32_t rate);
+uint8_t clkplan_get_profile(void);
+uint8_t clkplan_set_profile(uint8_t profile);
+void clkplan_report(uint16_t frames);
+
+#endif
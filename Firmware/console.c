@@ -0,0 +1,178 @@
+/*
+ * console.c - serial command console for RP2040 Audio
+ * 10-17-26 E. Brombaugh
+ */
+
+#include <stdio.h>
+#include "console.h"
+#include "audio.h"
+#include "fx.h"
+#include "i2s_fulldup.h"
+#include "prof.h"
+#include "menu.h"
+#include "clkplan.h"
+#include "bench.h"
+
+/*
+ * print the command list
+ */
+void console_help(void)
+{
+	printf("Commands:\n");
+	printf("  ?  this help\n");
+	printf("  a  show effect memory use\n");
+	printf("  b  cycle block size\n");
+	printf("  B  benchmark DSP kernels and effects as CSV (stops audio while running)\n");
+	printf("  c  show clock plan for the current profile\n");
+	printf("  C  cycle clock profile\n");
+	printf("  f  cycle algo change crossfade (off, 256, 1024, 4096 frames)\n");
+	printf("  k  show per-stage cycles of the current effect chain\n");
+	printf("  l  measure loopback latency at current block size\n");
+	printf("  L  measure loopback latency at all block sizes\n");
+	printf("  p  show audio path cycle profile\n");
+	printf("  P  reset audio path cycle profile\n");
+	printf("  m  cycle low latency output phase (off, 1/4, 1/2, 3/4 block)\n");
+	printf("  r  cycle sample rate (32k, 44.1k, 48k, 96k)\n");
+	printf("  x  show xrun counts and log\n");
+	printf("  X  clear xrun counts and log\n");
+	printf("  v  toggle xrun log on LCD\n");
+}
+
+/*
+ * run one latency measurement and report it
+ */
+void console_latency(void)
+{
+	int32_t lat;
+	
+	/* let any previous output die away first */
+	sleep_ms(100);
+	
+	lat = Audio_Measure_Latency();
+	if(lat < 0)
+		printf("%4d frames/block: %5d samples buffering, no loopback pulse detected\n",
+			i2s_fulldup_get_frames(), i2s_fulldup_get_latency());
+	else
+		printf("%4d frames/block: %5d samples buffering, %5d samples, %6d us round trip\n",
+			i2s_fulldup_get_frames(), i2s_fulldup_get_latency(),
+			lat, lat*10000/(i2s_fulldup_get_rate()/100));
+}
+
+/*
+ * init console
+ */
+void console_init(void)
+{
+	console_help();
+}
+
+/*
+ * poll for and handle serial commands
+ */
+void console_update(void)
+{
+	int c;
+	uint8_t i;
+	uint16_t frames, prev;
+	
+	c = getchar_timeout_us(0);
+	if(c == PICO_ERROR_TIMEOUT)
+		return;
+	
+	switch(c)
+	{
+		case 'a':
+			fx_arena_report();
+			fx_cache_report();
+			break;
+		
+		case 'b':
+			frames = i2s_fulldup_get_frames()<<1;
+			frames = frames > SMPS_MAX ? SMPS_MIN : frames;
+			i2s_fulldup_set_frames(frames);
+			break;
+		
+		case 'B':
+			bench_run();
+			break;
+		
+		case 'c':
+			clkplan_report(i2s_fulldup_get_frames());
+			break;
+		
+		case 'C':
+			if(i2s_fulldup_set_profile((clkplan_get_profile()+1)%(CLKPLAN_MAX_PROFILE+1)))
+				printf("Clock profile not available\n");
+			else
+				clkplan_report(i2s_fulldup_get_frames());
+			break;
+		
+		case 'f':
+			frames = fx_get_xfade() ? fx_get_xfade()<<2 : 256;
+			fx_set_xfade(frames > 4096 ? 0 : frames);
+			printf("Algo change crossfade %d frames\n", fx_get_xfade());
+			break;
+		
+		case 'k':
+			fx_report(i2s_fulldup_get_frames());
+			break;
+		
+		case 'l':
+			printf("Loopback latency (connect outputs to inputs):\n");
+			console_latency();
+			break;
+		
+		case 'L':
+			printf("Loopback latency (connect outputs to inputs):\n");
+			prev = i2s_fulldup_get_frames();
+			for(frames=SMPS_MIN;frames<=SMPS_MAX;frames<<=1)
+			{
+				i2s_fulldup_set_frames(frames);
+				console_latency();
+			}
+			i2s_fulldup_set_frames(prev);
+			break;
+		
+		case 'm':
+			if(i2s_fulldup_set_lowlat((i2s_fulldup_get_lowlat()+1)&3))
+				printf("Low latency mode needs the chained DMA transport\n");
+			else
+				printf("Low latency phase %d/4 block: %d samples buffering\n",
+					i2s_fulldup_get_lowlat(), i2s_fulldup_get_latency());
+			break;
+		
+		case 'r':
+			i = clkplan_rate_index(i2s_fulldup_get_rate());
+			i2s_fulldup_set_rate(clkplan_rates[(i+1)%CLKPLAN_NUM_RATES]);
+			break;
+		
+		case 'p':
+			prof_report();
+			break;
+		
+		case 'P':
+			prof_reset();
+			printf("Profile reset\n");
+			break;
+		
+		case 'x':
+			i2s_fulldup_xrun_report();
+			break;
+		
+		case 'X':
+			i2s_fulldup_clear_xruns();
+			printf("Xruns cleared\n");
+			break;
+		
+		case 'v':
+			menu_toggle_xruns();
+			break;
+		
+		case '?':
+			console_help();
+			break;
+		
+		default:
+			break;
+	}
+}
@@ -0,0 +1,14 @@
+/*
+ * console.h - serial command console for RP2040 Audio
+ * 10-17-26 E. Brombaugh
+ */
+
+#ifndef __console__
+#define __console__
+
+#include "main.h"
+
+void console_init(void);
+void console_update(void);
+
+#endif
@@ -1,8 +1,8 @@
-/* Included by my_resample.c */
+/* Included by fx_tape.c - 12 taps x 256 phases, centered between 1535 and 1536 */
 #define MY_FILTER_NMULT ((short)26)
 #define MY_FILTER_SCALE 13128 /* Unity-gain scale factor */
 #define MY_FILTER_NWING 3072 /* Filter table length */
-static short MY_FILTER_IMP[] /* Impulse response */ = {
+static const short MY_FILTER_IMP[] /* Impulse response */ = {
 -1,
 -1,
 -1,
@@ -0,0 +1,63 @@
+/*
+ * dsp_interp.c - SIO interpolator helpers for RP2040 Audio
+ * 10-17-26 E. Brombaugh
+ */
+
+#include "dsp_interp.h"
+
+#if PICO_ON_DEVICE
+/*
+ * set up interp1 to walk a ring of 2^bits packed frames at buf with the
+ * write and read frames at widx and ridx
+ */
+void __not_in_flash_func(dsp_interp_ring_init)(uint32_t *buf, uint8_t bits,
+	uint32_t widx, uint32_t ridx)
+{
+	interp_config cfg = interp_default_config();
+	
+	/* byte offsets - mask off the frame index bits above the word offset */
+	interp_config_set_shift(&cfg, 0);
+	interp_config_set_mask(&cfg, 2, bits+1);
+	interp_set_config(interp1, 0, &cfg);
+	interp_set_config(interp1, 1, &cfg);
+	
+	/* both lanes address the same buffer */
+	interp1->base[0] = (uint32_t)buf;
+	interp1->base[1] = (uint32_t)buf;
+	interp1->accum[0] = widx * sizeof(uint32_t);
+	interp1->accum[1] = ridx * sizeof(uint32_t);
+}
+
+/*
+ * set up interp0 for signed blends
+ */
+void __not_in_flash_func(dsp_interp_blend_init)(void)
+{
+	interp_config cfg = interp_default_config();
+	
+	interp_config_set_blend(&cfg, true);
+	interp_set_config(interp0, 0, &cfg);
+	
+	/* lane 1 gives the alpha in bits 7:0 and makes the blend signed */
+	cfg = interp_default_config();
+	interp_config_set_signed(&cfg, true);
+	interp_config_set_shift(&cfg, 0);
+	interp_config_set_mask(&cfg, 0, 7);
+	interp_set_config(interp0, 1, &cfg);
+}
+#else
+dsp_interp_sw_state dsp_interp_sw;
+
+void dsp_interp_ring_init(uint32_t *buf, uint8_t bits, uint32_t widx, uint32_t ridx)
+{
+	dsp_interp_sw.buf = buf;
+	dsp_interp_sw.mask = (1<<bits)-1;
+	dsp_interp_sw.acc[0] = widx;
+	dsp_interp_sw.acc[1] = ridx;
+}
+
+void dsp_interp_blend_init(void)
+{
+	dsp_interp_sw.alpha = 0;
+}
+#endif
@@ -0,0 +1,126 @@
+/*
+ * dsp_interp.h - SIO interpolator helpers for RP2040 Audio
+ * 10-17-26 E. Brombaugh
+ */
+
+#ifndef __dsp_interp__
+#define __dsp_interp__
+
+#include "main.h"
+#if PICO_ON_DEVICE
+#include "hardware/interp.h"
+#endif
+
+/*
+ * The interpolators are per core so these must be set up on the core that
+ * uses them - effects do it at the top of each Proc call.
+ *
+ * Ring: interp1 walks a power of 2 ring of packed stereo frames. Lane 0 is
+ * the write address and lane 1 a read tap a fixed distance behind. The
+ * accumulators hold byte offsets that the lane masks wrap, so stepping is
+ * just an add to both.
+ *
+ * Blend: interp0 in blend mode gives a + (b-a)*alpha/256 for an 8-bit alpha.
+ */
+
+#if PICO_ON_DEVICE
+/*
+ * current write address in the ring
+ */
+static inline uint32_t *dsp_interp_ring_wr(void)
+{
+	return (uint32_t *)interp1->peek[0];
+}
+
+/*
+ * current read address in the ring
+ */
+static inline uint32_t *dsp_interp_ring_rd(void)
+{
+	return (uint32_t *)interp1->peek[1];
+}
+
+/*
+ * advance write and read by one frame
+ */
+static inline void dsp_interp_ring_step(void)
+{
+	interp1->add_raw[0] = sizeof(uint32_t);
+	interp1->add_raw[1] = sizeof(uint32_t);
+}
+
+/*
+ * unwrapped write frame index
+ */
+static inline uint32_t dsp_interp_ring_widx(void)
+{
+	return interp1->accum[0] / sizeof(uint32_t);
+}
+
+/*
+ * set the blend fraction
+ */
+static inline void dsp_interp_blend_alpha(uint8_t alpha)
+{
+	interp0->accum[1] = alpha;
+}
+
+/*
+ * blend two samples - a at alpha = 0 toward b at alpha = 255
+ */
+static inline int32_t dsp_interp_blend(int32_t a, int32_t b)
+{
+	interp0->base[0] = a;
+	interp0->base[1] = b;
+	return (int32_t)interp0->peek[1];
+}
+#else
+/*
+ * software model of the above for builds that aren't on the RP2040
+ */
+typedef struct
+{
+	uint32_t *buf;
+	uint32_t mask;
+	uint32_t acc[2];
+	uint8_t alpha;
+} dsp_interp_sw_state;
+
+extern dsp_interp_sw_state dsp_interp_sw;
+
+static inline uint32_t *dsp_interp_ring_wr(void)
+{
+	return &dsp_interp_sw.buf[dsp_interp_sw.acc[0] & dsp_interp_sw.mask];
+}
+
+static inline uint32_t *dsp_interp_ring_rd(void)
+{
+	return &dsp_interp_sw.buf[dsp_interp_sw.acc[1] & dsp_interp_sw.mask];
+}
+
+static inline void dsp_interp_ring_step(void)
+{
+	dsp_interp_sw.acc[0]++;
+	dsp_interp_sw.acc[1]++;
+}
+
+static inline uint32_t dsp_interp_ring_widx(void)
+{
+	return dsp_interp_sw.acc[0];
+}
+
+static inline void dsp_interp_blend_alpha(uint8_t alpha)
+{
+	dsp_interp_sw.alpha = alpha;
+}
+
+static inline int32_t dsp_interp_blend(int32_t a, int32_t b)
+{
+	return a + (((b - a) * dsp_interp_sw.alpha)>>8);
+}
+#endif
+
+void dsp_interp_ring_init(uint32_t *buf, uint8_t bits, uint32_t widx, uint32_t ridx);
+void dsp_interp_blend_init(void);
+
+#endif
@@ -16,12 +16,111 @@ uint8_t dsp_ratio_hyst_arb(uint16_t *old, uint16_t in, uint8_t range);
  * signed saturation to 16-bit
  */
 /* as regular code */
-inline int16_t dsp_ssat16(int32_t in)
+static inline int16_t dsp_ssat16(int32_t in)
 {
 	in = in > 32767 ? 32767 : in;
 	in = in < -32768 ? -32768 : in;
 	return in;
 }
 
+/*
+ * Packed stereo:
+ * The I2S buffers and delay lines hold a frame as one 32-bit word with left
+ * in the low half and right in the high half. The M0+ has no SIMD so the
+ * math is still per channel, but working on whole words halves the loads
+ * and stores and lets both channels share one saturation test.
+ */
+
+/* left channel of a packed frame */
+static inline int32_t dsp_st_l(uint32_t in)
+{
+	return (int16_t)in;
+}
+
+/* right channel of a packed frame */
+static inline int32_t dsp_st_r(uint32_t in)
+{
+	return (int32_t)in >> 16;
+}
+
+/* pack two values already known to fit in 16 bits */
+static inline uint32_t dsp_st_pack(int32_t l, int32_t r)
+{
+	return (uint16_t)l | ((uint32_t)r << 16);
+}
+
+/* saturate both channels to 16 bits and pack */
+static inline uint32_t dsp_st_pack_ssat(int32_t l, int32_t r)
+{
+	/* both in range is the usual case so test them together */
+	if(((uint32_t)(l + 32768) | (uint32_t)(r + 32768)) >> 16)
+	{
+		l = dsp_ssat16(l);
+		r = dsp_ssat16(r);
+	}
+	return dsp_st_pack(l, r);
+}
+
+/* scale both channels by gain >> shift with saturation */
+static inline uint32_t dsp_st_gain(uint32_t in, int32_t gain, uint8_t shift)
+{
+	return dsp_st_pack_ssat((dsp_st_l(in) * gain)>>shift,
+		(dsp_st_r(in) * gain)>>shift);
+}
+
+/* (a * ga + b * gb) >> shift on both channels with saturation */
+static inline uint32_t dsp_st_mix(uint32_t a, int32_t ga, uint32_t b, int32_t gb,
+	uint8_t shift)
+{
+	return dsp_st_pack_ssat((dsp_st_l(a) * ga + dsp_st_l(b) * gb)>>shift,
+		(dsp_st_r(a) * ga + dsp_st_r(b) * gb)>>shift);
+}
+
+/*
+ * peak hold on both channels - pk holds the left and right peaks as
+ * unsigned 16-bit magnitudes packed the same way as the frames
+ */
+static inline uint32_t dsp_st_peak(uint32_t pk, uint32_t in)
+{
+	uint32_t l = (uint16_t)dsp_st_l(in), r = (uint16_t)dsp_st_r(in);
+	
+	/* rectify - -32768 becomes 32768 */
+	l = (l & 0x8000) ? (uint16_t)-l : l;
+	r = (r & 0x8000) ? (uint16_t)-r : r;
+	
+	/* hold */
+	l = l > (pk & 0xffff) ? l : (pk & 0xffff);
+	r = r > (pk >> 16) ? r : (pk >> 16);
+	
+	return l | (r << 16);
+}
+
+/*
+ * 32-bit samples:
+ * The audio path carries Q31 samples (24-bit codec data left justified).
+ * The M0+ only has a 32x32->32 multiply so gains are applied by splitting
+ * the sample into 16-bit halves. For 0 <= gain < 65536 (ga + gb < 65536 for
+ * the mix) and shift <= 16 the result is exactly (x * gain) >> shift as long
+ * as it fits in 32 bits. The halves are worked unsigned so nothing in the
+ * range overflows a signed multiply or shifts a negative value left.
+ */
+
+/* (x * gain) >> shift */
+static inline int32_t dsp_mul32(int32_t x, int32_t gain, uint8_t shift)
+{
+	return (int32_t)(((uint32_t)(x >> 16) * (uint32_t)gain << (16 - shift)) +
+		(((uint32_t)(x & 0xffff) * (uint32_t)gain) >> shift));
+}
+
+/* (a * ga + b * gb) >> shift */
+static inline int32_t dsp_mix32(int32_t a, int32_t ga, int32_t b, int32_t gb,
+	uint8_t shift)
+{
+	return (int32_t)((((uint32_t)(a >> 16) * (uint32_t)ga +
+		(uint32_t)(b >> 16) * (uint32_t)gb) << (16 - shift)) +
+		(((uint32_t)(a & 0xffff) * (uint32_t)ga +
+		(uint32_t)(b & 0xffff) * (uint32_t)gb) >> shift));
+}
+
 #endif
 
@@ -0,0 +1,401 @@
+/*
+ * dsp_os.c - 2x/4x oversampling for nonlinear effects
+ * 10-17-26 E. Brombaugh
+ *
+ * Each 2x step is a polyphase half-band FIR - half the taps are zero and
+ * the center is 1/2, so only the unique odd taps cost a multiply. Going up
+ * the odd phase is just a delayed copy. Going down, the even and odd
+ * samples go into separate histories and one output is made per pair.
+ * Samples are worked at 16-bit range so each tap is one 16x16 multiply
+ * with a 32-bit sum.
+ *
+ * 1x<->2x passes to 0.18fs of the 2x rate (17kHz at 48k) and rejects
+ * above 0.32fs by 63dB. 2x<->4x passes to 0.095fs by 65dB.
+ *
+ * The same stages run the other way round for effects that do part of
+ * their work below the block rate - decimate into the slow section and
+ * interpolate back out of it. Frames that don't make a whole group are
+ * carried between calls and the output is held DSP_OS_LAG frames back, so
+ * the result doesn't depend on the block size and the factor can change
+ * between blocks.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "dsp_os.h"
+#include "prof.h"
+
+/* Q15, sum to 1/4 - in RAM so core 1 doesn't wait on flash */
+static int16_t dsp_os_hb1[DSP_OS_HB1] = {10284, -3071, 1468, -734, 341, -135, 39};
+static int16_t dsp_os_hb2[DSP_OS_HB2] = {9762, -1873, 303};
+
+/*
+ * filter costs for picking factors - measured at boot on target by
+ * dsp_os_calibrate(), these starting values are what the host keeps
+ */
+uint16_t dsp_os_cyc[DSP_OS_NUM_FACTORS] =
+{
+	0,
+	340,
+	660,
+};
+
+uint16_t dsp_os_mr_cyc[DSP_OS_NUM_FACTORS] =
+{
+	0,
+	215,
+	250,
+};
+
+/*
+ * push a sample onto a doubled history of len - after, hist[0] is the
+ * newest and hist[j] is j samples older
+ */
+static inline int32_t *dsp_os_push(int32_t *buf, uint8_t *ptr, uint8_t len,
+	int32_t x)
+{
+	uint8_t p = *ptr ? *ptr-1 : len-1;
+	
+	buf[p] = buf[p+len] = x;
+	*ptr = p;
+	return &buf[p];
+}
+
+/*
+ * one sample up to two - m unique taps, y[0] then y[1] in time
+ */
+static inline void dsp_os_up(dsp_os_stage *st, const int16_t *h, uint8_t m,
+	int32_t x, int32_t *y)
+{
+	int32_t *hist = dsp_os_push(st->up, &st->up_ptr, 2*m, x);
+	int32_t acc = 1<<13;
+	uint8_t i;
+	
+	for(i=0;i<m;i++)
+		acc += h[i] * (hist[m+i] + hist[m-1-i]);
+	y[0] = acc >> 14;
+	y[1] = hist[m-1];
+}
+
+/*
+ * two samples down to one - m unique taps, u0 then u1 in time
+ */
+static inline int32_t dsp_os_down(dsp_os_stage *st, const int16_t *h, uint8_t m,
+	int32_t u0, int32_t u1)
+{
+	int32_t *even = dsp_os_push(st->dn_even, &st->dn_even_ptr, 2*m, u0);
+	int32_t *odd = dsp_os_push(st->dn_odd, &st->dn_odd_ptr, m+1, u1);
+	int32_t acc = (odd[m] << 14) + (1<<14);
+	uint8_t i;
+	
+	for(i=0;i<m;i++)
+		acc += h[i] * (even[m+i] + even[m-1-i]);
+	return acc >> 15;
+}
+
+/*
+ * clear the histories and set the factor - effects call it on core 1 when
+ * the rate changes
+ */
+void __not_in_flash_func(dsp_os_init)(dsp_os_state *os, uint8_t factor)
+{
+	memset(os, 0, sizeof(dsp_os_state));
+	os->factor = factor;
+	os->up_cnt = DSP_OS_LAG;
+}
+
+/*
+ * biggest factor whose filters plus kern_cyc per stereo frame at the
+ * oversampled rate fit in budget cycles per frame
+ */
+uint8_t __not_in_flash_func(dsp_os_factor)(uint32_t kern_cyc, uint32_t budget)
+{
+	if(dsp_os_cyc[2] + 4*kern_cyc <= budget)
+		return 4;
+	if(dsp_os_cyc[1] + 2*kern_cyc <= budget)
+		return 2;
+	return 1;
+}
+
+/*
+ * run kern on a block of Q31 stereo at the oversampled rate
+ */
+void __not_in_flash_func(dsp_os_proc)(dsp_os_state *os, dsp_os_kernel kern,
+	void *ctx, int32_t *dst, int32_t *src, uint16_t sz)
+{
+	dsp_os_stage *st;
+	int32_t a[2], b[4], x;
+	uint16_t i;
+	uint8_t ch;
+	
+	for(ch=0;ch<2;ch++)
+	{
+		st = os->stage[ch];
+		for(i=0;i<sz;i++)
+		{
+			x = src[2*i+ch] >> 16;
+			switch(os->factor)
+			{
+				case 4:
+					dsp_os_up(&st[0], dsp_os_hb1, DSP_OS_HB1, x, a);
+					dsp_os_up(&st[1], dsp_os_hb2, DSP_OS_HB2, a[0], &b[0]);
+					dsp_os_up(&st[1], dsp_os_hb2, DSP_OS_HB2, a[1], &b[2]);
+					b[0] = kern(ctx, ch, b[0]);
+					b[1] = kern(ctx, ch, b[1]);
+					b[2] = kern(ctx, ch, b[2]);
+					b[3] = kern(ctx, ch, b[3]);
+					a[0] = dsp_os_down(&st[1], dsp_os_hb2, DSP_OS_HB2, b[0], b[1]);
+					a[1] = dsp_os_down(&st[1], dsp_os_hb2, DSP_OS_HB2, b[2], b[3]);
+					x = dsp_os_down(&st[0], dsp_os_hb1, DSP_OS_HB1, a[0], a[1]);
+					break;
+				
+				case 2:
+					dsp_os_up(&st[0], dsp_os_hb1, DSP_OS_HB1, x, a);
+					a[0] = kern(ctx, ch, a[0]);
+					a[1] = kern(ctx, ch, a[1]);
+					x = dsp_os_down(&st[0], dsp_os_hb1, DSP_OS_HB1, a[0], a[1]);
+					break;
+				
+				default:
+					x = kern(ctx, ch, x);
+					break;
+			}
+			
+			/* back to Q31 with saturation - the filters can overshoot */
+			x = x > 32767 ? 32767 : x;
+			x = x < -32768 ? -32768 : x;
+			dst[2*i+ch] = x << 16;
+		}
+	}
+}
+
+/*
+ * one slow sample from a group of factor samples, back to Q31
+ */
+static inline int32_t dsp_os_dn_group(dsp_os_stage *st, uint8_t factor, int32_t *x)
+{
+	int32_t a[2], y;
+	
+	if(factor == 4)
+	{
+		a[0] = dsp_os_down(&st[1], dsp_os_hb2, DSP_OS_HB2, x[0], x[1]);
+		a[1] = dsp_os_down(&st[1], dsp_os_hb2, DSP_OS_HB2, x[2], x[3]);
+	}
+	else
+	{
+		a[0] = x[0];
+		a[1] = x[1];
+	}
+	y = dsp_os_down(&st[0], dsp_os_hb1, DSP_OS_HB1, a[0], a[1]);
+	
+	y = y > 32767 ? 32767 : y;
+	y = y < -32768 ? -32768 : y;
+	return y << 16;
+}
+
+/*
+ * take a block of Q31 stereo down by the factor and return how many frames
+ * were written - frames short of a whole group are carried to the next
+ * call, so any block size works. dst must hold DSP_OS_SLOW_MAX(sz) frames
+ * and not overlap src.
+ */
+uint16_t __not_in_flash_func(dsp_os_decimate)(dsp_os_state *os, int32_t *dst,
+	int32_t *src, uint16_t sz)
+{
+	dsp_os_stage *st;
+	int32_t *s, x[4];
+	uint16_t i, j, k, dn = os->dn_cnt, n = (dn + sz) / os->factor;
+	uint8_t ch;
+	
+	for(ch=0;ch<2;ch++)
+	{
+		st = os->stage[ch];
+		
+		/* groups that start with frames carried from the last call - j runs along both */
+		for(i=0,j=0;(i<n) && (j<dn);i++)
+		{
+			for(k=0;k<os->factor;k++,j++)
+				x[k] = (j < dn ? os->dn_buf[2*j+ch] : src[2*(j-dn)+ch]) >> 16;
+			dst[2*i+ch] = dsp_os_dn_group(st, os->factor, x);
+		}
+		
+		/* the rest line up with src */
+		s = src + 2*(j-dn) + ch;
+		for(;i<n;i++)
+		{
+			x[0] = s[0]>>16;
+			x[1] = s[2]>>16;
+			if(os->factor == 4)
+			{
+				x[2] = s[4]>>16;
+				x[3] = s[6]>>16;
+			}
+			s += 2*os->factor;
+			j += os->factor;
+			dst[2*i+ch] = dsp_os_dn_group(st, os->factor, x);
+		}
+		
+		/* keep what's left for the next call */
+		for(k=0;j<dn+sz;j++,k++)
+			os->dn_buf[2*k+ch] = j < dn ? os->dn_buf[2*j+ch] : src[2*(j-dn)+ch];
+	}
+	os->dn_cnt = dn + sz - n*os->factor;
+	
+	return n;
+}
+
+/*
+ * bring the frames from the matching dsp_os_decimate() back up to a block of
+ * sz, DSP_OS_LAG frames behind the input - dst and src must not overlap
+ */
+void __not_in_flash_func(dsp_os_interpolate)(dsp_os_state *os, int32_t *dst,
+	int32_t *src, uint16_t sz)
+{
+	dsp_os_stage *st;
+	int32_t *d, a[2], b[4];
+	uint16_t i, k, o, up = os->up_cnt, n = (DSP_OS_LAG - up + sz) / os->factor;
+	uint8_t ch;
+	
+	for(ch=0;ch<2;ch++)
+	{
+		st = os->stage[ch];
+		
+		/* frames left from the last call go first */
+		for(k=0,o=0;k<up;k++,o++)
+		{
+			if(o < sz)
+				dst[2*o+ch] = os->up_buf[2*k+ch];
+			else
+				os->up_buf[2*(o-sz)+ch] = os->up_buf[2*k+ch];
+		}
+		
+		d = dst + 2*o + ch;
+		for(i=0;i<n;i++)
+		{
+			dsp_os_up(&st[0], dsp_os_hb1, DSP_OS_HB1, src[2*i+ch]>>16, a);
+			if(os->factor == 4)
+			{
+				dsp_os_up(&st[1], dsp_os_hb2, DSP_OS_HB2, a[0], &b[0]);
+				dsp_os_up(&st[1], dsp_os_hb2, DSP_OS_HB2, a[1], &b[2]);
+			}
+			else
+			{
+				b[0] = a[0];
+				b[1] = a[1];
+			}
+			
+			for(k=0;k<os->factor;k++)
+			{
+				b[k] = b[k] > 32767 ? 32767 : b[k];
+				b[k] = b[k] < -32768 ? -32768 : b[k];
+			}
+			
+			/* the last frame can run past the block, that part waits for the next call */
+			if(o + os->factor <= sz)
+			{
+				for(k=0;k<os->factor;k++)
+				{
+					*d = b[k] << 16;
+					d += 2;
+				}
+			}
+			else
+			{
+				for(k=0;k<os->factor;k++)
+				{
+					if(o+k < sz)
+						dst[2*(o+k)+ch] = b[k] << 16;
+					else
+						os->up_buf[2*(o+k-sz)+ch] = b[k] << 16;
+				}
+			}
+			o += os->factor;
+		}
+	}
+	os->up_cnt = up + n*os->factor - sz;
+}
+
+#if PICO_ON_DEVICE
+#define DSP_OS_CAL_FRAMES 32	// block size the costs are measured at
+#define DSP_OS_CAL_RUNS 16		// timings per figure, the fastest is kept
+
+/* pass through kernel so only the filters are timed */
+static int32_t __not_in_flash_func(dsp_os_cal_pass)(void *ctx, uint8_t ch, int32_t x)
+{
+	return x;
+}
+
+/*
+ * fewest cycles per stereo frame to oversample by factor, or with mr set to
+ * decimate into and interpolate out of a slow section - rounded up
+ */
+static uint16_t dsp_os_cal_time(dsp_os_state *os, int32_t *buf, uint8_t factor,
+	uint8_t mr)
+{
+	int32_t *src = buf, *dst = &buf[2*DSP_OS_CAL_FRAMES], *lo = &buf[4*DSP_OS_CAL_FRAMES];
+	uint32_t t, best = PROF_MASK;
+	uint8_t i;
+	
+	dsp_os_init(os, factor);
+	for(i=0;i<DSP_OS_CAL_RUNS;i++)
+	{
+		t = prof_now();
+		if(mr)
+		{
+			dsp_os_decimate(os, lo, src, DSP_OS_CAL_FRAMES);
+			dsp_os_interpolate(os, dst, lo, DSP_OS_CAL_FRAMES);
+		}
+		else
+			dsp_os_proc(os, dsp_os_cal_pass, NULL, dst, src, DSP_OS_CAL_FRAMES);
+		t = (t - prof_now()) & PROF_MASK;
+		best = t < best ? t : best;
+	}
+	
+	return (best + DSP_OS_CAL_FRAMES - 1) / DSP_OS_CAL_FRAMES;
+}
+#endif
+
+/*
+ * measure dsp_os_cyc and dsp_os_mr_cyc with SysTick on the calling core -
+ * call before the audio core starts so the filters have the bus to
+ * themselves. The host has no cycle counter and keeps the starting values.
+ */
+void dsp_os_calibrate(void)
+{
+#if PICO_ON_DEVICE
+	dsp_os_state *os = malloc(sizeof(dsp_os_state));
+	int32_t *buf = malloc((4*DSP_OS_CAL_FRAMES + 2*DSP_OS_SLOW_MAX(DSP_OS_CAL_FRAMES))*
+		sizeof(int32_t));
+	uint32_t i, rnd = 0x12345678;
+	uint8_t f;
+	
+	if(!os || !buf)
+	{
+		printf("dsp_os_calibrate: no memory, keeping estimates\n");
+		goto done;
+	}
+	
+	/* noise in so nothing short-circuits */
+	for(i=0;i<2*DSP_OS_CAL_FRAMES;i++)
+	{
+		rnd ^= rnd << 13;
+		rnd ^= rnd >> 17;
+		rnd ^= rnd << 5;
+		buf[i] = rnd & ~0xff;
+	}
+	
+	prof_start();
+	for(f=1;f<DSP_OS_NUM_FACTORS;f++)
+	{
+		dsp_os_cyc[f] = dsp_os_cal_time(os, buf, 1<<f, 0);
+		dsp_os_mr_cyc[f] = dsp_os_cal_time(os, buf, 1<<f, 1);
+	}
+	printf("dsp_os_calibrate: 2x %u 4x %u half %u quarter %u cycles/frame\n",
+		dsp_os_cyc[1], dsp_os_cyc[2], dsp_os_mr_cyc[1], dsp_os_mr_cyc[2]);
+	
+done:
+	free(os);
+	free(buf);
+#endif
+}
@@ -0,0 +1,70 @@
+/*
+ * dsp_os.h - 2x/4x oversampling for nonlinear effects
+ * 10-17-26 E. Brombaugh
+ */
+
+#ifndef __dsp_os__
+#define __dsp_os__
+
+#include "main.h"
+
+#define DSP_OS_HB1 7		// unique taps in the 1x<->2x half-band
+#define DSP_OS_HB2 3		// unique taps in the 2x<->4x half-band
+#define DSP_OS_NUM_FACTORS 3
+#define DSP_OS_LAG 3		// frames the slow section output trails its input
+
+/* most frames dsp_os_decimate() can return for a block of sz */
+#define DSP_OS_SLOW_MAX(sz) (((sz)+DSP_OS_LAG)/2)
+
+/*
+ * per sample kernel run at the oversampled rate on one channel - samples
+ * are 16-bit range in an int32 and may go a little over it. The result is
+ * saturated after decimation, which aliases, so a kernel that clips should
+ * peak about 1dB under full scale to leave room for the filter's ringing.
+ */
+typedef int32_t (*dsp_os_kernel)(void *ctx, uint8_t ch, int32_t x);
+
+/* one half-band stage in each direction, histories doubled so they read straight */
+typedef struct
+{
+	int32_t up[4*DSP_OS_HB1];
+	int32_t dn_even[4*DSP_OS_HB1];
+	int32_t dn_odd[2*(DSP_OS_HB1+1)];
+	uint8_t up_ptr, dn_even_ptr, dn_odd_ptr;
+} dsp_os_stage;
+
+/*
+ * factor is the oversampling ratio for dsp_os_proc() or the rate divisor,
+ * 2 or 4, for dsp_os_decimate() and dsp_os_interpolate(). The up and down
+ * histories are separate so one state can do both ends of a slow section.
+ */
+typedef struct
+{
+	uint8_t factor;		// 1, 2 or 4
+	dsp_os_stage stage[2][2];	// [channel][1x<->2x, 2x<->4x]
+	int32_t dn_buf[2*DSP_OS_LAG];	// input short of a group, for the next decimate
+	int32_t up_buf[2*DSP_OS_LAG];	// output past the block, for the next interpolate
+	uint8_t dn_cnt, up_cnt;		// always add up to DSP_OS_LAG
+} dsp_os_state;
+
+/*
+ * filter cycles per stereo frame at 1x, 2x and 4x, not counting the kernel -
+ * measured at boot by dsp_os_calibrate()
+ */
+extern uint16_t dsp_os_cyc[DSP_OS_NUM_FACTORS];
+
+/*
+ * cycles per stereo frame to decimate into a half or quarter rate section
+ * and interpolate back out - also measured by dsp_os_calibrate()
+ */
+extern uint16_t dsp_os_mr_cyc[DSP_OS_NUM_FACTORS];
+
+void dsp_os_calibrate(void);
+void dsp_os_init(dsp_os_state *os, uint8_t factor);
+uint8_t dsp_os_factor(uint32_t kern_cyc, uint32_t budget);
+void dsp_os_proc(dsp_os_state *os, dsp_os_kernel kern, void *ctx, int32_t *dst,
+	int32_t *src, uint16_t sz);
+uint16_t dsp_os_decimate(dsp_os_state *os, int32_t *dst, int32_t *src, uint16_t sz);
+void dsp_os_interpolate(dsp_os_state *os, int32_t *dst, int32_t *src, uint16_t sz);
+
+#endif
@@ -5,8 +5,9 @@
  
 #include "fx.h"
 #include "audio.h"
-#include "fx_vca.h"
-#include "fx_cdl.h"
+#include "fx_chain.h"
+#include "dsp_os.h"
+#include "hardware/clocks.h"
 
 /* pre-allocated internal memory for DSP */
 uint32_t *fx_mem;
@@ -14,9 +15,47 @@ uint32_t *fx_mem;
 /* pointer to the fx data structure is void and recast inside the fns */
 void *fx;
 
-/* currently active algo */
+/* currently selected algo */
 uint8_t fx_algo;
 
+/*
+ * instance cache - effects switched away from are kept with their state
+ * until the arena needs the room, FX_NUM_ALGOS = empty
+ */
+static uint8_t fx_inst_algo[FX_CACHE_LEN];
+static void *fx_inst_blk[FX_CACHE_LEN];
+static uint32_t fx_inst_used[FX_CACHE_LEN];	// LRU stamp
+static uint32_t fx_inst_clock;
+static uint8_t fx_inst;						// instance of the selected algo
+static uint8_t fx_detached;					// instance only the benchmarks run
+static uint32_t fx_xf_seq;
+
+static uint8_t fx_cache_load(uint8_t algo);
+
+/* algo change crossfade length in frames, 0 = mute and switch */
+uint16_t fx_xfade_len = FX_XFADE_LEN;
+
+/* algo the audio core is running and the one it's crossfading to */
+static uint8_t fx_run_algo, fx_xf_algo;
+static void *fx_run, *fx_xf;
+static volatile uint32_t fx_xf_cnt;
+static uint32_t fx_xf_gain, fx_xf_inc;
+
+/* params the outgoing effect holds through a crossfade */
+static int16_t fx_xf_parm[ADC_NUMPARAMS];
+
+/* sample rate effects should use for times and frequencies */
+volatile uint32_t fx_sample_rate = SAMPLE_RATE;
+
+/* clk_sys for effects' cycle budgets, kept by core 0 so core 1 needn't ask the SDK */
+volatile uint32_t fx_sys_hz;
+
+/*
+ * params the running effect reads - chains point this at each stage's copy
+ * and an outgoing effect reads its snapshot while it crossfades
+ */
+volatile int16_t *fx_parm = ADC_param;
+
 
 /**************************************************************************/
 /******************* Bypass algo definition *******************************/
@@ -32,10 +71,10 @@ const char *bypass_param_names[] =
 /*
  * Bypass init
  */
-void * fx_bypass_Init(uint32_t *mem)
+void * fx_bypass_Init(void)
 {
-	/* no init - just return pointer */
-	return (void *)mem;
+	/* no state */
+	return NULL;
 }
 
 /*
@@ -49,7 +88,7 @@ void fx_bypass_Cleanup(void *dummy)
 /*
  * Bypass audio process is just in-out loopback / bypass
  */
-void __not_in_flash_func(fx_bypass_Proc)(void *dummy, int16_t *dst, int16_t *src, uint16_t sz)
+void __not_in_flash_func(fx_bypass_Proc)(void *dummy, int32_t *dst, int32_t *src, uint16_t sz)
 {
 	while(sz--)
 	{
@@ -82,32 +121,48 @@ void fx_bypass_Render_Parm(void *vblk, uint8_t idx)
 /*
  * Bypass init
  */
-const fx_struct fx_bypass_struct =
+fx_struct fx_bypass_struct =
 {
 	"Bypass",
 	3,
 	bypass_param_names,
 	fx_bypass_Init,
 	fx_bypass_Cleanup,
-	fx_bypass_Proc,
+	NULL,
 	fx_bypass_Render_Parm,
+	fx_bypass_Proc,
+	0,
 };
 
 
 /**************************************************************************/
 
-/* array of effect structures */
-const fx_struct *effects[FX_NUM_ALGOS] = {
-	&fx_bypass_struct,
-	&fx_vca_struct,
-	&fx_cdr_struct,
+/*
+ * array of effect structures - in RAM along with the structs themselves so
+ * dispatch from the audio core never reads flash
+ */
+#define FX_REGISTER(s, id) &s,
+fx_struct *effects[FX_NUM_ALGOS] =
+{
+#include "fx_registry.h"
 };
+#undef FX_REGISTER
+
+/* stable ids that key saved state */
+#define FX_REGISTER(s, id) id,
+const uint8_t fx_ids[FX_NUM_ALGOS] =
+{
+#include "fx_registry.h"
+};
+#undef FX_REGISTER
 
 /*
  * initialize the effects library
  */
 void fx_init(void)
 {
+	uint8_t i;
+	
 	/* allocate internal buffer memory */
 	printf("fx_init: attempt to allocate %d bytes internal RAM for audio...", FX_MAX_MEM);
 	fx_mem = malloc(FX_MAX_MEM);
@@ -119,43 +174,375 @@ void fx_init(void)
 		while(1){}
 	}
 	
+	fx_arena_init(fx_mem, FX_MAX_MEM);
+	fx_sys_hz = clock_get_hz(clk_sys);
+	
+	/* filter costs effects pick oversampling by, while core 0 has the bus */
+	dsp_os_calibrate();
+	
+	/* chain sizes come from their stages */
+	fx_chain_init();
+	
 	/* start off with bypass algo */
-	fx_algo = 0;
-	fx = effects[fx_algo]->init(fx_mem);
+	for(i=0;i<FX_CACHE_LEN;i++)
+		fx_inst_algo[i] = FX_NUM_ALGOS;
+	fx_inst_clock = 0;
+	fx_inst = FX_CACHE_LEN;
+	fx_detached = FX_CACHE_LEN;
+	fx_algo = FX_ALGO_fx_bypass_struct;
+	fx_inst = fx_cache_load(fx_algo);
+	fx = fx_inst_blk[fx_inst];
+	fx_xf_seq = 0;
+	fx_run_algo = fx_algo;
+	fx_run = fx;
+	fx_xf_cnt = 0;
+}
+
+/*
+ * drop a cached instance and free its memory
+ */
+static void fx_cache_evict(uint8_t inst)
+{
+	printf("fx_cache_evict: %s\n", effects[fx_inst_algo[inst]]->name);
+	effects[fx_inst_algo[inst]]->cleanup(fx_inst_blk[inst]);
+	fx_arena_release(inst);
+	fx_inst_algo[inst] = FX_NUM_ALGOS;
+}
+
+/*
+ * least recently used instance other than the selected one, FX_CACHE_LEN = none
+ */
+static uint8_t fx_cache_lru(void)
+{
+	uint8_t i, lru = FX_CACHE_LEN;
+	
+	for(i=0;i<FX_CACHE_LEN;i++)
+		if((fx_inst_algo[i] < FX_NUM_ALGOS) && (i != fx_inst) &&
+			((lru == FX_CACHE_LEN) || (fx_inst_used[i] < fx_inst_used[lru])))
+			lru = i;
+	
+	return lru;
+}
+
+/*
+ * find a cached instance of an algo, FX_CACHE_LEN = none
+ */
+static uint8_t fx_cache_find(uint8_t algo)
+{
+	uint8_t i;
+	
+	for(i=0;i<FX_CACHE_LEN;i++)
+		if(fx_inst_algo[i] == algo)
+			return i;
+	
+	return FX_CACHE_LEN;
 }
 
 /*
- * switch algorithms
+ * init a new instance of an algo, evicting LRU ones until it fits
+ * returns FX_CACHE_LEN if it won't fit next to the selected one or its
+ * init fails, with nothing left allocated
+ */
+static uint8_t fx_cache_load(uint8_t algo)
+{
+	uint8_t inst, lru;
+	uint32_t used;
+	
+	/* free instance slot */
+	inst = fx_cache_find(FX_NUM_ALGOS);
+	if(inst == FX_CACHE_LEN)
+	{
+		inst = fx_cache_lru();
+		if(inst == FX_CACHE_LEN)
+			return inst;
+		fx_cache_evict(inst);
+	}
+	
+	/* make room */
+	while(fx_arena_begin(inst, algo, effects[algo]->mem_size))
+	{
+		lru = fx_cache_lru();
+		if(lru == FX_CACHE_LEN)
+			return lru;
+		fx_cache_evict(lru);
+	}
+	
+	fx_inst_blk[inst] = effects[algo]->init();
+	used = fx_arena_end();
+	
+	/* only effects with no memory have no block, for the rest it failed */
+	if((fx_inst_blk[inst] == NULL) && effects[algo]->mem_size)
+	{
+		printf("fx_cache_load: %s init failed\n", effects[algo]->name);
+		fx_arena_release(inst);
+		return FX_CACHE_LEN;
+	}
+	fx_inst_algo[inst] = algo;
+	if(used > effects[algo]->mem_size)
+		printf("fx_cache_load: %s used %u bytes, declared %u\n", effects[algo]->name,
+			used, effects[algo]->mem_size);
+	
+	return inst;
+}
+
+/*
+ * switch algorithms - only used by core 0
+ * A cached instance is resumed as it was left, otherwise a new one is
+ * initialized while the current one keeps running. The audio core then
+ * crossfades to it. If it won't fit next to the current one the output is
+ * muted, everything is dropped and the change goes through bypass.
  */
 void fx_select_algo(uint8_t algo)
 {
-	uint8_t prev_fx_algo;
+	uint32_t seq;
+	uint8_t inst;
 	
 	/* only legal algorithms */
-	if(algo >= FX_NUM_ALGOS)
+	if((algo >= FX_NUM_ALGOS) || (algo == fx_algo))
 		return;
 	
-	/* bypass during init */
-	prev_fx_algo = fx_algo;
-	Audio_Set_Algo(&fx_algo, 0);
+	/* a crossfade in progress has to finish before its outgoing effect can be evicted */
+	while(!Audio_Cmd_Done(fx_xf_seq) || fx_xf_cnt){}
 	
-	/* cleanup previous effect */
-	effects[prev_fx_algo]->cleanup(fx);
+	inst = fx_cache_find(algo);
+	if(inst == FX_CACHE_LEN)
+		inst = fx_cache_load(algo);
 	
-	/* init next effect from effect array */
-	fx = effects[algo]->init(fx_mem);
+	if(inst < FX_CACHE_LEN)
+	{
+		/* the next change waits on the switch too, not just on a crossfade */
+		if(fx_xfade_len)
+			fx_xf_seq = Audio_Set_Algo(algo, fx_inst_blk[inst], 1);
+		else
+		{
+			Audio_Wait_Mute(Audio_Set_Mute(1));
+			fx_xf_seq = Audio_Set_Algo(algo, fx_inst_blk[inst], 0);
+			Audio_Set_Mute(0);
+		}
+	}
+	else
+	{
+		/* bypass during init - the old effect's memory is reused so wait for it to stop */
+		Audio_Wait_Mute(Audio_Set_Mute(1));
+		seq = Audio_Set_Algo(FX_ALGO_fx_bypass_struct, NULL, 0);
+		while(!Audio_Cmd_Done(seq)){}
 		
-	/* switch to next effect */
-	Audio_Set_Algo(&fx_algo, algo);
+		/* drop everything and init next effect from effect array */
+		fx_cache_evict(fx_inst);
+		fx_inst = FX_CACHE_LEN;
+		fx_cache_flush();
+		inst = fx_cache_load(algo);
+		if(inst == FX_CACHE_LEN)
+		{
+			printf("fx_select_algo: %s doesn't fit in fx_mem\n", effects[algo]->name);
+			algo = FX_ALGO_fx_bypass_struct;
+			inst = fx_cache_load(algo);
+		}
+		
+		/* switch to next effect */
+		fx_xf_seq = Audio_Set_Algo(algo, fx_inst_blk[inst], 0);
+		Audio_Set_Mute(0);
+	}
+	
+	fx_inst = inst;
+	fx_inst_used[inst] = ++fx_inst_clock;
+	fx_algo = algo;
+	fx = fx_inst_blk[inst];
+}
+
+/*
+ * drop every cached instance but the selected one so the next selection of
+ * each algo starts from a fresh init
+ */
+void fx_cache_flush(void)
+{
+	uint8_t inst;
+	
+	while((inst = fx_cache_lru()) < FX_CACHE_LEN)
+		fx_cache_evict(inst);
+}
+
+/*
+ * init a fresh instance of an algo beside the live one that the audio core
+ * never runs, for the benchmarks - only used by core 0. Returns 1 if it
+ * won't fit. It must be dropped before the next fx_select_algo().
+ */
+uint8_t fx_load_detached(uint8_t algo, void **blk)
+{
+	if(algo >= FX_NUM_ALGOS)
+		return 1;
+	
+	fx_detached = fx_cache_load(algo);
+	if(fx_detached == FX_CACHE_LEN)
+		return 1;
+	
+	*blk = fx_inst_blk[fx_detached];
+	return 0;
+}
+
+/*
+ * drop the detached instance and free its memory - quietly, so it doesn't
+ * land in the middle of the benchmark CSV
+ */
+void fx_drop_detached(void)
+{
+	if(fx_detached < FX_CACHE_LEN)
+	{
+		effects[fx_inst_algo[fx_detached]]->cleanup(fx_inst_blk[fx_detached]);
+		fx_arena_release(fx_detached);
+		fx_inst_algo[fx_detached] = FX_NUM_ALGOS;
+	}
+	fx_detached = FX_CACHE_LEN;
+}
+
+/*
+ * list the cached instances by slot with how long since each was used
+ */
+void fx_cache_report(void)
+{
+	uint8_t i;
+	
+	printf("Effect instances:\n");
+	for(i=0;i<FX_CACHE_LEN;i++)
+		if(fx_inst_algo[i] < FX_NUM_ALGOS)
+			printf("  inst %d %-8s %s, last used %u switches ago\n", i,
+				effects[fx_inst_algo[i]]->name, i == fx_inst ? "live" : "suspended",
+				fx_inst_clock - fx_inst_used[i]);
+}
+
+/*
+ * start running an algo - called by the audio core from its command queue
+ */
+void __not_in_flash_func(fx_switch)(uint8_t algo, void *blk, uint8_t xfade)
+{
+	uint16_t len = fx_xfade_len;
+	uint8_t i;
+	
+	if(xfade && len)
+	{
+		/* params posted after the switch are for the incoming effect */
+		for(i=0;i<ADC_NUMPARAMS;i++)
+			fx_xf_parm[i] = ADC_param[i];
+		fx_xf_algo = algo;
+		fx_xf = blk;
+		fx_xf_gain = 0;
+		fx_xf_inc = 65536/len;
+		fx_xf_cnt = len;
+	}
+	else
+	{
+		fx_run_algo = algo;
+		fx_run = blk;
+	}
 }
 
 /*
- * process audio through current effect
+ * get algo change crossfade length in frames
  */
-void __not_in_flash_func(fx_proc)(int16_t *dst, int16_t *src, uint16_t sz)
+uint16_t fx_get_xfade(void)
 {
+	return fx_xfade_len;
+}
+
+/*
+ * set algo change crossfade length in frames, 0 = mute and switch
+ */
+void fx_set_xfade(uint16_t len)
+{
+	fx_xfade_len = len;
+}
+
+/*
+ * tell effects the sample rate has changed - they pick it up on their
+ * next Proc call
+ */
+void fx_set_rate(uint32_t rate)
+{
+	fx_sample_rate = rate;
+}
+
+/*
+ * tell effects clk_sys has changed - only used by core 0 with the audio
+ * core parked, effects re-plan their budgets on their next Proc call
+ */
+void fx_set_clock(uint32_t hz)
+{
+	fx_sys_hz = hz;
+}
+
+/* top 16 bits of the input for 16-bit effects */
+static uint32_t fx_shim_src[SMPS_MAX];
+
+/* incoming effect output during a crossfade */
+static int32_t fx_xf_buf[2*SMPS_MAX];
+
+/*
+ * process audio through one effect
+ */
+void __not_in_flash_func(fx_run_effect)(const fx_struct *effect, void *blk,
+	int32_t *dst, int32_t *src, uint16_t sz)
+{
+	uint32_t *dst16 = (uint32_t *)dst;
+	int16_t i;
+	
 	/* use effect structure function pointers */
-	effects[fx_algo]->proc(fx, dst, src, sz);
+	if(effect->proc32)
+	{
+		effect->proc32(blk, dst, src, sz);
+		return;
+	}
+	
+	/* 16-bit effects work on packed frames of the top 16 bits */
+	for(i=0;i<sz;i++)
+		fx_shim_src[i] = dsp_st_pack(src[2*i]>>16, src[2*i+1]>>16);
+	
+	/* render into the front half of dst and widen from the back in place */
+	effect->proc(blk, (int16_t *)dst16, (int16_t *)fx_shim_src, sz);
+	for(i=sz-1;i>=0;i--)
+	{
+		dst[2*i+1] = dsp_st_r(dst16[i]) << 16;
+		dst[2*i] = dsp_st_l(dst16[i]) << 16;
+	}
+}
+
+/*
+ * process audio through the running effect, crossfading to the next
+ */
+void __not_in_flash_func(fx_proc)(int32_t *dst, int32_t *src, uint16_t sz)
+{
+	uint16_t i;
+	int32_t g;
+	
+	if(!fx_xf_cnt)
+	{
+		fx_run_effect(effects[fx_run_algo], fx_run, dst, src, sz);
+		return;
+	}
+	
+	/* outgoing effect keeps the params it had so it fades out unchanged */
+	fx_parm = fx_xf_parm;
+	fx_run_effect(effects[fx_run_algo], fx_run, dst, src, sz);
+	fx_parm = ADC_param;
+	
+	/* both effects run during the fade - gain is Q16 and mixed at Q12 */
+	fx_run_effect(effects[fx_xf_algo], fx_xf, fx_xf_buf, src, sz);
+	for(i=0;i<sz;i++)
+	{
+		g = fx_xf_gain >> 4;
+		dst[2*i] = dsp_mix32(fx_xf_buf[2*i], g, dst[2*i], 4096-g, 12);
+		dst[2*i+1] = dsp_mix32(fx_xf_buf[2*i+1], g, dst[2*i+1], 4096-g, 12);
+		fx_xf_gain = fx_xf_gain + fx_xf_inc > 65536 ? 65536 : fx_xf_gain + fx_xf_inc;
+	}
+	
+	/* done - the incoming effect takes over */
+	if(fx_xf_cnt > sz)
+		fx_xf_cnt -= sz;
+	else
+	{
+		fx_run_algo = fx_xf_algo;
+		fx_run = fx_xf;
+		fx_xf_cnt = 0;
+	}
 }
 
 /*
@@ -166,6 +553,28 @@ uint8_t fx_get_algo(void)
 	return fx_algo;
 }
 
+/*
+ * get the selected algo's instance
+ */
+void *fx_get_blk(void)
+{
+	return fx;
+}
+
+/*
+ * find the algo with a saved state id - bypass if it isn't built in
+ */
+uint8_t fx_find_id(uint8_t id)
+{
+	uint8_t i;
+	
+	for(i=0;i<FX_NUM_ALGOS;i++)
+		if(fx_ids[i] == id)
+			return i;
+	
+	return FX_ALGO_fx_bypass_struct;
+}
+
 /*
  * get number of params
  */
@@ -198,5 +607,11 @@ void fx_render_parm(uint8_t idx)
 	effects[fx_algo]->render_parm(fx, idx);
 }
 
-
-
+/*
+ * report the running cost of the current effect
+ */
+void fx_report(uint16_t frames)
+{
+	if(fx_chain_report(effects[fx_algo], fx, frames))
+		printf("%s is not a chain - see the profile for its cost\n", effects[fx_algo]->name);
+}
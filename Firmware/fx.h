@@ -13,13 +13,15 @@
 #include "dsp_lib.h"
 #include "adc.h"
 #include "gfx.h"
+#include "fx_arena.h"
 
-#define SAMPLE_RATE     (48000)
+#define SAMPLE_RATE     (48000)	// default - current rate is fx_sample_rate
 #define FRAMESZ			(32)
 
-#define FX_NUM_ALGOS  3
 #define FX_MAX_PARAMS 3
 #define FX_MAX_MEM (129*1024)
+#define FX_XFADE_LEN 1024	// default algo change crossfade in frames, 0 = mute
+#define FX_CACHE_LEN 4		// effect instances kept resident including the live one
 
 typedef float float32_t;
 
@@ -31,21 +33,57 @@ typedef struct
 	const char *name;
 	uint8_t parms;
 	const char **parm_names;
-	void * (*init)(uint32_t *mem);
+	void * (*init)(void);		// allocates with fx_alloc(), NULL if that fails
 	void (*cleanup)(void *blk);
 	void (*proc)(void *blk, int16_t *dst, int16_t *src, uint16_t sz);
 	void (*render_parm)(void *blk, uint8_t idx);
+	void (*proc32)(void *blk, int32_t *dst, int32_t *src, uint16_t sz);	// NULL = use 16-bit proc
+	uint32_t mem_size;	// most bytes init allocates, with 8-byte rounding
 } fx_struct;
 
-extern const fx_struct *effects[FX_NUM_ALGOS];
+/*
+ * algos are listed in fx_registry.h, generated from FX_EFFECTS at build time,
+ * as FX_REGISTER(struct, nvs id) - each gets an FX_ALGO_<struct> index
+ */
+#define FX_REGISTER(s, id) extern fx_struct s;
+#include "fx_registry.h"
+#undef FX_REGISTER
+
+#define FX_REGISTER(s, id) FX_ALGO_##s,
+enum fx_algos
+{
+#include "fx_registry.h"
+	FX_NUM_ALGOS
+};
+#undef FX_REGISTER
+
+extern fx_struct *effects[FX_NUM_ALGOS];
+extern const uint8_t fx_ids[FX_NUM_ALGOS];
+extern volatile uint32_t fx_sample_rate;
+extern volatile uint32_t fx_sys_hz;
+extern volatile int16_t *fx_parm;
 
 void fx_bypass_Cleanup(void *dummy);
 void fx_bypass_Render_Parm(void *blk, uint8_t idx);
 
 void fx_init(void);
 void fx_select_algo(uint8_t algo);
-void fx_proc(int16_t *dst, int16_t *src, uint16_t sz);
+void fx_cache_flush(void);
+uint8_t fx_load_detached(uint8_t algo, void **blk);
+void fx_drop_detached(void);
+void fx_cache_report(void);
+void fx_set_rate(uint32_t rate);
+void fx_set_clock(uint32_t hz);
+uint16_t fx_get_xfade(void);
+void fx_set_xfade(uint16_t len);
+void fx_switch(uint8_t algo, void *blk, uint8_t xfade);
+void fx_run_effect(const fx_struct *effect, void *blk, int32_t *dst, int32_t *src,
+	uint16_t sz);
+void fx_proc(int32_t *dst, int32_t *src, uint16_t sz);
+void fx_report(uint16_t frames);
 uint8_t fx_get_algo(void);
+void *fx_get_blk(void);
+uint8_t fx_find_id(uint8_t id);
 uint8_t fx_get_num_parms(void);
 char * fx_get_algo_name(void);
 char * fx_get_parm_name(uint8_t idx);
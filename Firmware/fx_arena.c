@@ -0,0 +1,258 @@
+/*
+ * fx_arena.c - effect memory allocator for rp2040_audio
+ * 10-17-26 E. Brombaugh
+ *
+ * Each effect instance gets one contiguous region of fx_mem, sized by the
+ * mem_size it declares and placed first fit, and its allocations are bumped
+ * out of that region. Small state can ask for the fast pool in SRAM4 which
+ * is placed first fit directly. All of an instance's memory is released
+ * together. Effects allocate from their init functions which run between
+ * fx_arena_begin() and fx_arena_end() on core 0.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "fx_arena.h"
+#include "fx.h"
+
+typedef struct
+{
+	uint8_t *base;
+	uint32_t size;
+} fx_pool;
+
+static fx_pool fx_pools[FX_NUM_BANKS];
+static uint8_t __scratch_x("fx_fast") fx_fast_mem[FX_FAST_MEM] __attribute__((aligned(8)));
+
+/* space taken from the pools, in address order */
+static fx_alloc_entry fx_allocs[FX_ARENA_MAX_REGIONS];
+static uint8_t fx_num_allocs;
+
+/* allocations carved from regions - only for the report, never limit a fit */
+static fx_alloc_entry fx_names[FX_ARENA_MAX_NAMES];
+static uint8_t fx_num_names;
+
+/* instance being set up and the region it bumps from */
+static uint8_t fx_arena_owner, fx_arena_algo;
+static uint8_t *fx_arena_ptr, *fx_arena_lim, *fx_arena_start;
+static uint32_t fx_arena_hwm[FX_NUM_ALGOS];
+
+/*
+ * set up the pools
+ */
+void fx_arena_init(uint32_t *mem, uint32_t size)
+{
+	fx_pools[FX_BANK_ANY].base = (uint8_t *)mem;
+	fx_pools[FX_BANK_ANY].size = size;
+	fx_pools[FX_BANK_FAST].base = fx_fast_mem;
+	fx_pools[FX_BANK_FAST].size = FX_FAST_MEM;
+	fx_num_allocs = 0;
+	fx_num_names = 0;
+	memset(fx_arena_hwm, 0, sizeof(fx_arena_hwm));
+}
+
+/*
+ * first fit in a pool between the regions already there - NULL if no gap
+ * entries are kept in address order so the gaps are between neighbours
+ */
+static uint8_t *fx_pool_fit(uint8_t bank, uint32_t size, uint32_t align, uint8_t *idx)
+{
+	fx_pool *p = &fx_pools[bank];
+	uint8_t *addr = p->base, *end;
+	uint8_t i;
+	
+	if(fx_num_allocs >= FX_ARENA_MAX_REGIONS)
+		return NULL;
+	
+	for(i=0;i<=fx_num_allocs;i++)
+	{
+		/* skip regions in the other pool */
+		if((i < fx_num_allocs) && (fx_allocs[i].bank != bank))
+			continue;
+		
+		end = i < fx_num_allocs ? fx_allocs[i].addr : p->base + p->size;
+		addr = (uint8_t *)(((uintptr_t)addr + align - 1) & ~(uintptr_t)(align - 1));
+		if((addr <= end) && (size <= end - addr))
+		{
+			*idx = i;
+			return addr;
+		}
+		if(i < fx_num_allocs)
+			addr = fx_allocs[i].addr + fx_allocs[i].size;
+	}
+	
+	return NULL;
+}
+
+/*
+ * add a region at a position in the list
+ */
+static void fx_arena_add(uint8_t idx, const char *name, uint8_t *addr, uint32_t size,
+	uint8_t bank)
+{
+	memmove(&fx_allocs[idx+1], &fx_allocs[idx], (fx_num_allocs-idx)*sizeof(fx_alloc_entry));
+	fx_allocs[idx].name = name;
+	fx_allocs[idx].addr = addr;
+	fx_allocs[idx].size = size;
+	fx_allocs[idx].owner = fx_arena_owner;
+	fx_allocs[idx].bank = bank;
+	fx_num_allocs++;
+}
+
+/*
+ * reserve a region for an instance of an algo and direct allocations to it
+ * returns 1 if there's no gap big enough
+ */
+uint8_t fx_arena_begin(uint8_t owner, uint8_t algo, uint32_t size)
+{
+	uint8_t idx;
+	
+	fx_arena_owner = owner;
+	fx_arena_algo = algo;
+	fx_arena_start = fx_arena_ptr = fx_arena_lim = NULL;
+	if(!size)
+		return 0;
+	
+	fx_arena_start = fx_pool_fit(FX_BANK_ANY, size, 8, &idx);
+	if(fx_arena_start == NULL)
+		return 1;
+	fx_arena_add(idx, effects[algo]->name, fx_arena_start, size, FX_BANK_ANY);
+	fx_arena_ptr = fx_arena_start;
+	fx_arena_lim = fx_arena_start + size;
+	
+	return 0;
+}
+
+/*
+ * finish allocating for an instance - returns bytes it holds and tracks the peak
+ */
+uint32_t fx_arena_end(void)
+{
+	uint32_t used = fx_arena_ptr - fx_arena_start;
+	uint8_t i;
+	
+	for(i=0;i<fx_num_allocs;i++)
+		if((fx_allocs[i].owner == fx_arena_owner) && (fx_allocs[i].bank == FX_BANK_FAST))
+			used += fx_allocs[i].size;
+	
+	if(fx_arena_hwm[fx_arena_algo] < used)
+		fx_arena_hwm[fx_arena_algo] = used;
+	
+	return used;
+}
+
+/*
+ * free everything an instance holds
+ */
+void fx_arena_release(uint8_t owner)
+{
+	uint8_t i, j;
+	
+	for(i=0,j=0;i<fx_num_allocs;i++)
+		if(fx_allocs[i].owner != owner)
+			fx_allocs[j++] = fx_allocs[i];
+	fx_num_allocs = j;
+	
+	for(i=0,j=0;i<fx_num_names;i++)
+		if(fx_names[i].owner != owner)
+			fx_names[j++] = fx_names[i];
+	fx_num_names = j;
+}
+
+/*
+ * biggest region that could be reserved now
+ */
+uint32_t fx_arena_largest(void)
+{
+	fx_pool *p = &fx_pools[FX_BANK_ANY];
+	uint8_t *addr = p->base, *end;
+	uint32_t largest = 0;
+	uint8_t i;
+	
+	for(i=0;i<=fx_num_allocs;i++)
+	{
+		if((i < fx_num_allocs) && (fx_allocs[i].bank != FX_BANK_ANY))
+			continue;
+		
+		end = i < fx_num_allocs ? fx_allocs[i].addr : p->base + p->size;
+		if(largest < end - addr)
+			largest = end - addr;
+		if(i < fx_num_allocs)
+			addr = fx_allocs[i].addr + fx_allocs[i].size;
+	}
+	
+	return largest;
+}
+
+/*
+ * allocate for the instance being set up - align must be a power of 2
+ * bank is a hint, anything that won't fit in the fast pool comes from the region
+ */
+void *fx_alloc(uint32_t size, uint32_t align, uint8_t bank, const char *name)
+{
+	uint8_t *addr = NULL;
+	uint8_t idx;
+	
+	align = align < 4 ? 4 : align;
+	if(bank == FX_BANK_FAST)
+	{
+		addr = fx_pool_fit(FX_BANK_FAST, size, align, &idx);
+		if(addr)
+		{
+			fx_arena_add(idx, name, addr, size, FX_BANK_FAST);
+			return addr;
+		}
+	}
+	
+	if(fx_arena_ptr)
+		addr = (uint8_t *)(((uintptr_t)fx_arena_ptr + align - 1) & ~(uintptr_t)(align - 1));
+	if((addr == NULL) || (addr > fx_arena_lim) || (size > fx_arena_lim - addr))
+	{
+		printf("fx_alloc: %s - no room for %u bytes\n", name, size);
+		return NULL;
+	}
+	fx_arena_ptr = addr + size;
+	
+	/* keep the name for the report if there's room */
+	if(fx_num_names < FX_ARENA_MAX_NAMES)
+	{
+		fx_names[fx_num_names].name = name;
+		fx_names[fx_num_names].addr = addr;
+		fx_names[fx_num_names].size = size;
+		fx_names[fx_num_names].owner = fx_arena_owner;
+		fx_names[fx_num_names].bank = FX_BANK_ANY;
+		fx_num_names++;
+	}
+	
+	return addr;
+}
+
+/*
+ * print regions, allocations, free space and per-algo peak usage
+ */
+void fx_arena_report(void)
+{
+	const char *bank_names[FX_NUM_BANKS] = {"main", "fast"};
+	uint8_t i, j;
+	
+	printf("Effect memory:\n");
+	for(i=0;i<fx_num_allocs;i++)
+	{
+		printf("  %-12s inst %d %s 0x%08X %6u bytes\n", fx_allocs[i].name,
+			fx_allocs[i].owner, bank_names[fx_allocs[i].bank],
+			(uint32_t)(uintptr_t)fx_allocs[i].addr, fx_allocs[i].size);
+		
+		/* allocations carved from this region */
+		for(j=0;j<fx_num_names;j++)
+			if((fx_names[j].addr >= fx_allocs[i].addr) &&
+				(fx_names[j].addr < fx_allocs[i].addr + fx_allocs[i].size))
+				printf("    %-12s         0x%08X %6u bytes\n", fx_names[j].name,
+					(uint32_t)(uintptr_t)fx_names[j].addr, fx_names[j].size);
+	}
+	printf("  Largest free region %u of %u bytes\n", fx_arena_largest(),
+		fx_pools[FX_BANK_ANY].size);
+	printf("  Peak use by algo (declared):\n");
+	for(i=0;i<FX_NUM_ALGOS;i++)
+		printf("  %-8s %6u (%u)\n", effects[i]->name, fx_arena_hwm[i],
+			effects[i]->mem_size);
+}
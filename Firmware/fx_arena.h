@@ -0,0 +1,45 @@
+/*
+ * fx_arena.h - effect memory allocator for rp2040_audio
+ * 10-17-26 E. Brombaugh
+ */
+
+#ifndef __fx_arena__
+#define __fx_arena__
+
+#include "main.h"
+
+#define FX_FAST_MEM 1024		// bytes of SRAM4 shared with the audio core stack
+#define FX_ARENA_MAX_REGIONS 32	// instance regions plus fast pool allocations
+#define FX_ARENA_MAX_NAMES 32	// allocations within regions kept for the report
+
+/* round a size up to the default 8 byte alignment */
+#define FX_MEM_ROUND(x) (((x)+7) & ~7)
+
+/*
+ * bank hints
+ */
+enum fx_banks
+{
+	FX_BANK_ANY,	// striped main SRAM in fx_mem
+	FX_BANK_FAST,	// SRAM4 - no contention with core 0 or DMA, falls back to ANY
+	FX_NUM_BANKS
+};
+
+typedef struct
+{
+	const char *name;
+	uint8_t *addr;
+	uint32_t size;
+	uint8_t owner;		// effect instance
+	uint8_t bank;
+} fx_alloc_entry;
+
+void fx_arena_init(uint32_t *mem, uint32_t size);
+uint8_t fx_arena_begin(uint8_t owner, uint8_t algo, uint32_t size);
+uint32_t fx_arena_end(void);
+void fx_arena_release(uint8_t owner);
+uint32_t fx_arena_largest(void);
+void *fx_alloc(uint32_t size, uint32_t align, uint8_t bank, const char *name);
+void fx_arena_report(void);
+
+#endif
@@ -4,21 +4,23 @@
  */
  
 #include "fx_cdl.h"
+#include "dsp_interp.h"
 
-#define XFADE_BITS 11
+#define XFADE_BITS 10		// crossfade length in frames
+#define DLY_BITS 15			// delay buffer length in frames
 
 typedef struct 
 {
 	uint8_t type;			/* algo type */
 	uint8_t rng;			/* short/med/long range */
 	uint16_t rng_raw;		/* raw range from ADC param */
-	int16_t *dlybuf;		/* external delay buffer address */
+	uint32_t *dlybuf;		/* external delay buffer address */
 	uint32_t len;			/* buffer length */
-	uint8_t init;			/* initial pass flag for cleanout */
 	uint32_t wptr;			/* write pointer */
 	uint32_t roff1, roff2;	/* read offsets - main and xfade */
 	uint16_t xflen, xfcnt;	/* Cross-fade length and counter */
 	int16_t dly;			/* delay value w/ hysteresis */
+	uint32_t rate;			/* sample rate delay was computed for */
 	int32_t dcb[2];			/* dc block on feedback */
 	int16_t fb[2];
 } fx_cdl_blk;
@@ -40,27 +42,32 @@ const char *cd_ranges[] =
 /*
  * Clean Delay common init
  */
-void * fx_cd_common_Init(uint32_t *mem, uint8_t type)
+void * fx_cd_common_Init(uint8_t type)
 {
-	/* set up instance in mem area provided */
-	fx_cdl_blk *blk = (fx_cdl_blk *)mem;
-	mem += sizeof(fx_cdl_blk)/sizeof(uint32_t);
+	/* set up instance */
+	fx_cdl_blk *blk = fx_alloc(sizeof(fx_cdl_blk), 4, FX_BANK_FAST, "ClnDly");
+	
+	if(blk == NULL)
+		return NULL;
 	
 	/* set type / range */
 	blk->type = type>>2;
 	blk->rng = 1+(type&0x3);
 	blk->rng_raw = 0;
 	
-	/* init delay buffering */
-	blk->dlybuf = (int16_t *)mem;
-	blk->len = (FX_MAX_MEM-sizeof(fx_cdl_blk)) / (2*sizeof(int16_t));	// length in samples
-	blk->init = 1;
+	/* init delay buffering - cleared so unwritten taps read as silence */
+	blk->len = 1<<DLY_BITS;	// length in stereo frames
+	blk->dlybuf = fx_alloc(blk->len*sizeof(uint32_t), 4, FX_BANK_ANY, "ClnDly ring");
+	if(blk->dlybuf == NULL)
+		return NULL;
+	memset(blk->dlybuf, 0, blk->len*sizeof(uint32_t));
 	blk->wptr = 0;
 	blk->roff1 = 1;
 	blk->roff2 = 0;
 	blk->xfcnt = 0;
 	blk->xflen = 1<<XFADE_BITS;
 	blk->dly = 0;
+	blk->rate = fx_sample_rate;
 	blk->dcb[0] = blk->dcb[1] = 0;
 	blk->fb[0] = blk->fb[1] = 0;
 		
@@ -71,9 +78,20 @@ void * fx_cd_common_Init(uint32_t *mem, uint8_t type)
 /*
  * Clean Delay Range init
  */
-void * fx_cdr_Init(uint32_t *mem)
+void * fx_cdr_Init(void)
+{
+	return fx_cd_common_Init(4);
+}
+
+/*
+ * delay in samples for current setting - the control is scaled so the
+ * delay time is the same at any rate, limited by the buffer length
+ */
+static uint32_t fx_cdl_delay(fx_cdl_blk *blk)
 {
-	return fx_cd_common_Init(mem, 4);
+	uint32_t dly = ((blk->dly<<blk->rng) * blk->rate) / SAMPLE_RATE + 1;
+	
+	return dly > blk->len-2 ? blk->len-2 : dly;
 }
 
 /*
@@ -85,9 +103,9 @@ void __not_in_flash_func(fx_cd_common_Proc)(void *vblk, int16_t *dst, int16_t *s
 	uint16_t i;
 	int16_t fb_lvl;
 	int32_t rptr;
-	int32_t mix;
-	int16_t out;
-	uint8_t chl;
+	int32_t mix, l, r;
+	uint32_t in, tap;
+	uint32_t *s = (uint32_t *)src, *d = (uint32_t *)dst;
 	
 	/* update delay parameters if not already crossfading */
 	if(!blk->xfcnt)
@@ -97,79 +115,97 @@ void __not_in_flash_func(fx_cd_common_Proc)(void *vblk, int16_t *dst, int16_t *s
 		/* set range realtime if type == 1 */
 		if(blk->type)
 		{
-			rng_upd = dsp_ratio_hyst_arb(&blk->rng_raw, ADC_param[3], 2);
+			rng_upd = dsp_ratio_hyst_arb(&blk->rng_raw, fx_parm[3], 2);
 			blk->rng = 1+blk->rng_raw;
 		}
 		
+		/* sample rate changed */
+		if(blk->rate != fx_sample_rate)
+		{
+			blk->rate = fx_sample_rate;
+			rng_upd = 1;
+		}
+		
 		/* get raw delay value and apply hysteresis */
-		if(dsp_gethyst(&blk->dly, ADC_param[1]) || rng_upd)
+		if(dsp_gethyst(&blk->dly, fx_parm[1]) || rng_upd)
 		{
 			/* compute next delay and start crossfade */
-			blk->roff2 = (blk->dly<<blk->rng) + 1;
-			blk->roff2 = blk->roff2 > blk->len-2 ? blk->len-2 : blk->roff2;
+			blk->roff2 = fx_cdl_delay(blk);
 			blk->xfcnt = blk->xflen;
 		}
 	}
 	
 	/* get the feedback value */
-	fb_lvl = ADC_param[2];
+	fb_lvl = fx_parm[2];
+	
+	/* write and main tap addressing in interp1, crossfade blend in interp0 */
+	dsp_interp_ring_init(blk->dlybuf, DLY_BITS, blk->wptr, blk->wptr-blk->roff1);
+	if(blk->xfcnt)
+		dsp_interp_blend_init();
 	
-	/* loop over the buffers */
+	/* loop over the buffers a whole stereo frame at a time */
 	for(i=0;i<sz;i++)
 	{
-		for(chl=0;chl<2;chl++)
+		/* mix feedback into write buffer */
+		in = *s++;
+		*dsp_interp_ring_wr() = dsp_st_pack_ssat(
+			((dsp_st_l(in)<<12) + blk->fb[0] * fb_lvl)>>12,
+			((dsp_st_r(in)<<12) + blk->fb[1] * fb_lvl)>>12);
+		
+		/* get main tap */
+		tap = *dsp_interp_ring_rd();
+		l = dsp_st_l(tap);
+		r = dsp_st_r(tap);
+		
+		/* process crossfade */
+		if(blk->xfcnt)
 		{
-			/* mix feedback into write buffer */
-			mix = (*(src++)<<12) + blk->fb[chl] * fb_lvl;
-			blk->dlybuf[2*blk->wptr+chl] = dsp_ssat16(mix>>12);
-			
-			/* get main tap */
-			rptr = blk->wptr-blk->roff1;
-			rptr = rptr < 0 ? blk->len + rptr : rptr;
-			rptr = rptr >= blk->len ? rptr - blk->len : rptr;
-			if(!blk->init || (rptr < blk->wptr))
-				out = blk->dlybuf[2*rptr+chl];
+			/*
+			 * fade from main tap toward the new one - the blend stops at
+			 * 255/256 so the last frame takes the new tap outright
+			 */
+			rptr = (dsp_interp_ring_widx() - blk->roff2) & (blk->len-1);
+			tap = blk->dlybuf[rptr];
+			if(blk->xfcnt == 1)
+			{
+				l = dsp_st_l(tap);
+				r = dsp_st_r(tap);
+			}
 			else
-				out = 0;
-			
-			/* process crossfade */
-			if(blk->xfcnt)
 			{
-				/* do crossfade mix */
-				rptr = blk->wptr-blk->roff2;
-				rptr = rptr < 0 ? blk->len + rptr : rptr;
-				rptr = rptr >= blk->len ? rptr - blk->len : rptr;
-				mix  = (int32_t)out * blk->xfcnt;
-				if(!blk->init || (rptr < blk->wptr))
-					mix += blk->dlybuf[2*rptr+chl] * (blk->xflen - blk->xfcnt);
-				out = dsp_ssat16(mix>>XFADE_BITS);
-				
-				/* update crossfade */
-				blk->xfcnt--;
-				if(blk->xfcnt == 0)
-				{
-					/* update current delay */
-					blk->roff1 = blk->roff2;
-				}
+				dsp_interp_blend_alpha((blk->xflen - blk->xfcnt + 1)>>(XFADE_BITS-8));
+				l = dsp_interp_blend(l, dsp_st_l(tap));
+				r = dsp_interp_blend(r, dsp_st_r(tap));
 			}
 			
-			/* dc block on feedback */
-			mix = (int32_t)out - (blk->dcb[chl]>>8); 
-			blk->dcb[chl] += mix;
-			blk->fb[chl] = dsp_ssat16(mix);
-			
-			/* output */
-			*dst++ = out;
+			/* update crossfade */
+			blk->xfcnt--;
+			if(blk->xfcnt == 0)
+			{
+				/* update current delay and move the main tap to it */
+				blk->roff1 = blk->roff2;
+				dsp_interp_ring_init(blk->dlybuf, DLY_BITS,
+					dsp_interp_ring_widx(), dsp_interp_ring_widx()-blk->roff1);
+			}
 		}
-	
-		/* update write pointer */
-		rptr = blk->wptr;
-		blk->wptr = (blk->wptr + 1) % blk->len;
 		
-		/* clear init flag if write ptr wrapped */
-		if(rptr > blk->wptr)
-			blk->init = 0;
+		/* dc block on feedback */
+		mix = l - (blk->dcb[0]>>8); 
+		blk->dcb[0] += mix;
+		blk->fb[0] = dsp_ssat16(mix);
+		mix = r - (blk->dcb[1]>>8); 
+		blk->dcb[1] += mix;
+		blk->fb[1] = dsp_ssat16(mix);
+		
+		/* output */
+		*d++ = dsp_st_pack(l, r);
+		
+		/* update write and read pointers */
+		dsp_interp_ring_step();
 	}
+	
+	/* save write pointer */
+	blk->wptr = dsp_interp_ring_widx() & (blk->len-1);
 }
 
 /*
@@ -194,9 +230,7 @@ void fx_cdl_Render_Parm(void *vblk, uint8_t idx)
 	switch(idx)
 	{
 		case 1:	// Delay
-			ms = (blk->dly<<blk->rng) + 1;
-			ms = ms > blk->len-2 ? blk->len-2 : ms;
-			ms = ms / (SAMPLE_RATE/1000);
+			ms = fx_cdl_delay(blk) * 1000 / blk->rate;
 			sprintf(txtbuf, "%6d ms ", ms);
 			break;
 		
@@ -225,5 +259,7 @@ fx_struct fx_cdr_struct =
 	fx_bypass_Cleanup,
 	fx_cd_common_Proc,
 	fx_cdl_Render_Parm,
+	NULL,
+	FX_MEM_ROUND(sizeof(fx_cdl_blk)) + FX_MEM_ROUND((1<<DLY_BITS)*sizeof(uint32_t)),
 };
 
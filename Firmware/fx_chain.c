@@ -0,0 +1,193 @@
+/*
+ * fx_chain.c - serial effect chains for rp2040_audio
+ * 10-17-26 E. Brombaugh
+ *
+ * A chain is an fx_struct that runs its stages one after another in place
+ * on the output block. Each stage gets its own copy of the params, filled
+ * every block from the chain's params or fixed values, and allocates its
+ * memory on the chain's side of the arena.
+ */
+
+#include "fx_chain.h"
+#include "fx_vca.h"
+#include "fx_cdl.h"
+#include "prof.h"
+#include "hardware/clocks.h"
+
+typedef struct
+{
+	const fx_chain_def *def;
+	void *blk[FX_CHAIN_MAX];
+	int16_t parm[FX_CHAIN_MAX][FX_MAX_PARAMS+1];
+	uint32_t cyc[FX_CHAIN_MAX];		/* last block cycles per stage */
+	uint32_t cyc_max[FX_CHAIN_MAX];	/* worst block cycles per stage */
+} fx_chain_blk;
+
+/**************************************************************************/
+/******************* chain engine *****************************************/
+/**************************************************************************/
+
+/*
+ * chain init - stages allocate their own memory on the same side
+ */
+void * fx_chain_common_Init(const fx_chain_def *def)
+{
+	fx_chain_blk *blk = fx_alloc(sizeof(fx_chain_blk), 4, FX_BANK_FAST, "Chain");
+	uint8_t i;
+	
+	if(blk == NULL)
+		return NULL;
+	
+	blk->def = def;
+	for(i=0;i<def->stages;i++)
+	{
+		/* a stage that didn't get its memory fails the whole chain */
+		blk->blk[i] = def->stage[i].fx->init();
+		if((blk->blk[i] == NULL) && def->stage[i].fx->mem_size)
+			return NULL;
+		blk->cyc[i] = blk->cyc_max[i] = 0;
+	}
+	
+	return (void *)blk;
+}
+
+/*
+ * chain cleanup
+ */
+void fx_chain_Cleanup(void *vblk)
+{
+	fx_chain_blk *blk = vblk;
+	uint8_t i;
+	
+	for(i=0;i<blk->def->stages;i++)
+		blk->def->stage[i].fx->cleanup(blk->blk[i]);
+}
+
+/*
+ * chain audio process - first stage reads src, the rest work in place
+ */
+void __not_in_flash_func(fx_chain_Proc)(void *vblk, int32_t *dst, int32_t *src, uint16_t sz)
+{
+	fx_chain_blk *blk = vblk;
+	const fx_chain_stage *stage = blk->def->stage;
+	volatile int16_t *parm = fx_parm;
+	uint32_t t0, t1, cyc;
+	uint8_t i, j;
+	
+	t0 = prof_now();
+	for(i=0;i<blk->def->stages;i++)
+	{
+		/* route chain params to this stage */
+		for(j=0;j<FX_MAX_PARAMS;j++)
+			blk->parm[i][j+1] = stage[i].map[j] ? parm[stage[i].map[j]] :
+				stage[i].fixed[j];
+		fx_parm = blk->parm[i];
+		
+		fx_run_effect(stage[i].fx, blk->blk[i], dst, i ? dst : src, sz);
+		
+		/* SysTick counts down */
+		t1 = prof_now();
+		cyc = (t0 - t1) & PROF_MASK;
+		blk->cyc[i] = cyc;
+		if(blk->cyc_max[i] < cyc)
+			blk->cyc_max[i] = cyc;
+		t0 = t1;
+	}
+	fx_parm = parm;
+}
+
+/*
+ * chains hold the sum of their stages - sizes aren't constants so fill
+ * them in at startup
+ */
+static void fx_chain_size(fx_struct *chain, const fx_chain_def *def)
+{
+	uint8_t i;
+	
+	chain->mem_size = FX_MEM_ROUND(sizeof(fx_chain_blk));
+	for(i=0;i<def->stages;i++)
+		chain->mem_size += def->stage[i].fx->mem_size;
+}
+
+/*
+ * print per-stage cycle costs against the block budget
+ * returns 1 if the effect isn't a chain
+ */
+uint8_t fx_chain_report(const fx_struct *effect, void *vblk, uint16_t frames)
+{
+	fx_chain_blk *blk = vblk;
+	uint32_t budget, sum = 0, sum_max = 0;
+	uint8_t i;
+	
+	if(effect->proc32 != fx_chain_Proc)
+		return 1;
+	
+	budget = (uint64_t)clock_get_hz(clk_sys)*frames/fx_sample_rate;
+	printf("Chain %s, %d frames/block, %u cycles budget\n", effect->name, frames, budget);
+	printf("  Stage      last     max\n");
+	for(i=0;i<blk->def->stages;i++)
+	{
+		printf("  %-6s %8u %7u\n", blk->def->stage[i].fx->name,
+			blk->cyc[i], blk->cyc_max[i]);
+		sum += blk->cyc[i];
+		sum_max += blk->cyc_max[i];
+	}
+	printf("  Total  %8u %7u  %u%% of budget worst case\n", sum, sum_max,
+		sum_max*100/budget);
+	
+	return 0;
+}
+
+/**************************************************************************/
+/******************* VCA into clean delay *********************************/
+/**************************************************************************/
+
+const char *vcadly_param_names[] =
+{
+	"Gain  ",
+	"DlyAmt",
+	"Feedbk",
+};
+
+fx_chain_stage vcadly_stages[] =
+{
+	{&fx_vca_struct, {1, 0, 0}, {0, 0, 0}},
+	{&fx_cdr_struct, {2, 3, 0}, {0, 0, 2048}},	// medium range
+};
+
+fx_chain_def vcadly_def =
+{
+	2,
+	vcadly_stages,
+};
+
+/*
+ * VCA > Delay init
+ */
+void * fx_vcadly_Init(void)
+{
+	return fx_chain_common_Init(&vcadly_def);
+}
+
+fx_struct fx_vcadly_struct =
+{
+	"VCADly",
+	3,
+	vcadly_param_names,
+	fx_vcadly_Init,
+	fx_chain_Cleanup,
+	NULL,
+	fx_bypass_Render_Parm,
+	fx_chain_Proc,
+	0,		// filled in by fx_chain_init()
+};
+
+/**************************************************************************/
+
+/*
+ * size the chains
+ */
+void fx_chain_init(void)
+{
+	fx_chain_size(&fx_vcadly_struct, &vcadly_def);
+}
@@ -0,0 +1,35 @@
+/*
+ * fx_chain.h - serial effect chains for rp2040_audio
+ * 10-17-26 E. Brombaugh
+ */
+
+#ifndef __fx_chain__
+#define __fx_chain__
+
+#include "fx.h"
+
+#define FX_CHAIN_MAX 4		// stages per chain
+
+/*
+ * one stage - each stage param comes from a chain param or a fixed value
+ */
+typedef struct
+{
+	fx_struct *fx;
+	uint8_t map[FX_MAX_PARAMS];		// chain param 1-3 for stage param 1-3, 0 = fixed
+	int16_t fixed[FX_MAX_PARAMS];
+} fx_chain_stage;
+
+/* kept in RAM with the rest of the dispatch path */
+typedef struct
+{
+	uint8_t stages;
+	fx_chain_stage *stage;
+} fx_chain_def;
+
+extern fx_struct fx_vcadly_struct;
+
+void fx_chain_init(void);
+uint8_t fx_chain_report(const fx_struct *effect, void *blk, uint16_t frames);
+
+#endif
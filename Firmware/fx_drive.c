@@ -0,0 +1,206 @@
+/*
+ * fx_drive.c - Drive effect for RP2040_Audio
+ * 10-17-26 E. Brombaugh
+ *
+ * Gain into a cubic soft clipper, oversampled so the harmonics it makes
+ * don't fold back down, then a tone low-pass and output level. The
+ * oversampling factor is the biggest that fits DRIVE_SHARE of the frame
+ * budget at the current clock and sample rate. The clipper's own cost is
+ * timed on the part the first time Drive loads, DRIVE_KERN_CYC is only the
+ * estimate used until then and what the host keeps.
+ */
+
+#include "fx_drive.h"
+#include "dsp_os.h"
+#include "prof.h"
+
+#define DRIVE_SHARE 40		// % of the cycles per frame the oversampled part may use
+#define DRIVE_KERN_CYC 60	// estimated clipper cycles per stereo frame at the oversampled rate
+#define DRIVE_CAL_FRAMES 32	// block the clipper is timed on
+#define DRIVE_CAL_RUNS 16	// timings, the fastest is kept
+
+typedef struct
+{
+	dsp_os_state os;
+	uint32_t rate;			/* sample rate the factor was picked for */
+	uint32_t hz;			/* clk_sys the factor was picked for */
+	int32_t gain;			/* clipper input gain, Q8 */
+	int32_t lpf[2];			/* tone filter state, Q30 */
+} fx_drive_blk;
+
+/* clipper cycles per stereo frame at the oversampled rate, timed once */
+static uint16_t fx_drive_kern_cyc = DRIVE_KERN_CYC;
+static uint8_t fx_drive_timed;
+
+static void fx_drive_measure(fx_drive_blk *blk);
+
+const char *drive_param_names[] =
+{
+	"Drive ",
+	"Tone  ",
+	"Level ",
+};
+
+/*
+ * pick the oversampling factor for the current rate and clock - in RAM as
+ * it runs on core 1 when either changes
+ */
+static void __not_in_flash_func(fx_drive_rate)(fx_drive_blk *blk)
+{
+	uint32_t budget = fx_sys_hz / fx_sample_rate * DRIVE_SHARE / 100;
+	
+	blk->rate = fx_sample_rate;
+	blk->hz = fx_sys_hz;
+	dsp_os_init(&blk->os, dsp_os_factor(fx_drive_kern_cyc, budget));
+}
+
+/*
+ * Drive init
+ */
+void * fx_drive_Init(void)
+{
+	fx_drive_blk *blk = fx_alloc(sizeof(fx_drive_blk), 4, FX_BANK_ANY, "Drive");
+	
+	if(blk == NULL)
+		return NULL;
+	
+	fx_drive_measure(blk);
+	fx_drive_rate(blk);
+	blk->gain = 256;
+	blk->lpf[0] = blk->lpf[1] = 0;
+	
+	return (void *)blk;
+}
+
+/*
+ * soft clipper - 1.5x - 0.5x^3 in Q15, flat past full scale, topping out
+ * 1dB down so the decimator's ringing isn't clipped at the output
+ */
+static int32_t __not_in_flash_func(fx_drive_clip)(void *ctx, uint8_t ch, int32_t x)
+{
+	fx_drive_blk *blk = ctx;
+	
+	x = (x * blk->gain) >> 8;
+	x = x > 32767 ? 32767 : x;
+	x = x < -32767 ? -32767 : x;
+	return ((3*x - ((((x*x)>>15)*x)>>15)) * 7) >> 4;
+}
+
+/*
+ * Drive audio process
+ */
+void __not_in_flash_func(fx_drive_Proc)(void *vblk, int32_t *dst, int32_t *src, uint16_t sz)
+{
+	fx_drive_blk *blk = vblk;
+	int32_t coef, level, l, r;
+	uint16_t i;
+	
+	if((blk->rate != fx_sample_rate) || (blk->hz != fx_sys_hz))
+		fx_drive_rate(blk);
+	
+	/* 1x to 65x, a quarter of the way is 5x */
+	blk->gain = 256 + ((fx_parm[1] * fx_parm[1]) >> 12) * 4;
+	
+	dsp_os_proc(&blk->os, fx_drive_clip, blk, dst, src, sz);
+	
+	/* one pole tone from dark to open then level, Q30 so the step can't overflow */
+	coef = 128 + ((fx_parm[2] * 3968) >> 12);
+	level = fx_parm[3];
+	l = blk->lpf[0];
+	r = blk->lpf[1];
+	for(i=0;i<sz;i++)
+	{
+		l += dsp_mul32((dst[2*i]>>1) - l, coef, 12);
+		r += dsp_mul32((dst[2*i+1]>>1) - r, coef, 12);
+		dst[2*i] = dsp_mul32(l, level, 11);
+		dst[2*i+1] = dsp_mul32(r, level, 11);
+	}
+	blk->lpf[0] = l;
+	blk->lpf[1] = r;
+}
+
+/*
+ * Render parameter for drive - the drive shows the oversampling factor
+ */
+void fx_drive_Render_Parm(void *vblk, uint8_t idx)
+{
+	fx_drive_blk *blk = vblk;
+	char txtbuf[32];
+	GFX_RECT rect =
+	{
+		.x0 = 65,
+		.y0 = idx*10+10,
+		.x1 = 158,
+		.y1 = idx*10+17
+	};
+	
+	if(idx == 0)
+		return;
+	
+	if(idx == 1)
+		sprintf(txtbuf, "%2d%% %dx ", ADC_param[idx]/41, blk->os.factor);
+	else
+		sprintf(txtbuf, "%2d%% ", ADC_param[idx]/41);
+	gfx_drawstrrect(&rect, txtbuf);
+}
+
+/*
+ * time the clipper with SysTick on this core - the fastest of a few runs at
+ * 2x on noise driven hard, less the 2x filters. Only the first Init does it
+ * and SysTick doesn't count on the host, which keeps DRIVE_KERN_CYC.
+ */
+static void fx_drive_measure(fx_drive_blk *blk)
+{
+#if PICO_ON_DEVICE
+	int32_t *buf;
+	uint32_t i, t, best = PROF_MASK, rnd = 0x12345678;
+	
+	if(fx_drive_timed)
+		return;
+	
+	buf = malloc(4*DRIVE_CAL_FRAMES*sizeof(int32_t));
+	if(!buf)
+		return;
+	
+	/* noise in so nothing short-circuits */
+	for(i=0;i<2*DRIVE_CAL_FRAMES;i++)
+	{
+		rnd ^= rnd << 13;
+		rnd ^= rnd >> 17;
+		rnd ^= rnd << 5;
+		buf[i] = rnd & ~0xff;
+	}
+	
+	blk->gain = 256*16;
+	dsp_os_init(&blk->os, 2);
+	prof_start();
+	for(i=0;i<DRIVE_CAL_RUNS;i++)
+	{
+		t = prof_now();
+		dsp_os_proc(&blk->os, fx_drive_clip, blk, &buf[2*DRIVE_CAL_FRAMES], buf,
+			DRIVE_CAL_FRAMES);
+		t = (t - prof_now()) & PROF_MASK;
+		best = t < best ? t : best;
+	}
+	free(buf);
+	
+	/* two oversampled frames per frame at 2x */
+	best = (best + DRIVE_CAL_FRAMES - 1) / DRIVE_CAL_FRAMES;
+	fx_drive_kern_cyc = best > dsp_os_cyc[1] ? (best - dsp_os_cyc[1] + 1) / 2 : 0;
+	fx_drive_timed = 1;
+	printf("fx_drive_measure: clipper %u cycles/frame\n", fx_drive_kern_cyc);
+#endif
+}
+
+fx_struct fx_drive_struct =
+{
+	"Drive",
+	3,
+	drive_param_names,
+	fx_drive_Init,
+	fx_bypass_Cleanup,
+	NULL,
+	fx_drive_Render_Parm,
+	fx_drive_Proc,
+	FX_MEM_ROUND(sizeof(fx_drive_blk)),
+};
@@ -0,0 +1,13 @@
+/*
+ * fx_drive.h - Drive effect for RP2040_Audio
+ * 10-17-26 E. Brombaugh
+ */
+
+#ifndef __fx_drive__
+#define __fx_drive__
+
+#include "fx.h"
+
+extern fx_struct fx_drive_struct;
+
+#endif
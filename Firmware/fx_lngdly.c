@@ -0,0 +1,215 @@
+/*
+ * fx_lngdly.c - Long Delay effect for RP2040_Audio
+ * 10-17-26 E. Brombaugh
+ *
+ * A clean delay whose ring and feedback run at half or quarter rate. The
+ * input is decimated with the dsp_os half-bands, delayed and fed back in
+ * the slow section, and interpolated back out, so each slow frame of ring
+ * holds two or four frames of time and the loop costs a half or a quarter
+ * as much. Repeats are band-limited to about 10kHz or 5kHz at 48k.
+ */
+
+#include "fx_lngdly.h"
+#include "audio.h"
+#include "dsp_os.h"
+
+#define LNG_BITS 14			// delay buffer length in slow frames
+#define LNG_XFADE_BITS 8	// delay change crossfade in slow frames
+
+typedef struct
+{
+	dsp_os_state mr;		/* slow section in and out */
+	uint32_t *dlybuf;		/* delay buffer */
+	uint32_t wptr;			/* write pointer */
+	uint32_t roff1, roff2;	/* read offsets - main and xfade */
+	uint16_t xfcnt;			/* crossfade counter */
+	uint16_t div_raw;		/* rate divisor from ADC param, 0 = half */
+	int16_t dly;			/* delay value w/ hysteresis */
+	uint32_t rate;			/* sample rate delay was computed for */
+	int32_t dcb[2];			/* dc block on feedback */
+	int16_t fb[2];
+	int32_t lo[2*DSP_OS_SLOW_MAX(SMPS_MAX)];	/* slow section */
+} fx_lngdly_blk;
+
+const char *lngdly_param_names[] =
+{
+	"DlyAmt",
+	"Feedbk",
+	"Rate  ",
+};
+
+const char *lngdly_rates[] =
+{
+	"Half",
+	"Quarter",
+};
+
+/*
+ * Long Delay init
+ */
+void * fx_lngdly_Init(void)
+{
+	fx_lngdly_blk *blk = fx_alloc(sizeof(fx_lngdly_blk), 4, FX_BANK_ANY, "LngDly");
+	
+	if(blk == NULL)
+		return NULL;
+	
+	/* delay buffer cleared so unwritten frames read as silence */
+	blk->dlybuf = fx_alloc((1<<LNG_BITS)*sizeof(uint32_t), 4, FX_BANK_ANY, "LngDly ring");
+	if(blk->dlybuf == NULL)
+		return NULL;
+	memset(blk->dlybuf, 0, (1<<LNG_BITS)*sizeof(uint32_t));
+	
+	dsp_os_init(&blk->mr, 2);
+	blk->wptr = 0;
+	blk->roff1 = 1;
+	blk->roff2 = 0;
+	blk->xfcnt = 0;
+	blk->div_raw = 0;
+	blk->dly = 0;
+	blk->rate = fx_sample_rate;
+	blk->dcb[0] = blk->dcb[1] = 0;
+	blk->fb[0] = blk->fb[1] = 0;
+	
+	return (void *)blk;
+}
+
+/*
+ * delay in slow frames for current setting - the slow rate is the sample
+ * rate over the divisor so the knob gives twice the time at quarter rate
+ */
+static uint32_t fx_lngdly_delay(fx_lngdly_blk *blk)
+{
+	uint32_t dly = ((blk->dly<<2) * blk->rate) / SAMPLE_RATE + 1;
+	
+	return dly > (1<<LNG_BITS)-2 ? (1<<LNG_BITS)-2 : dly;
+}
+
+/*
+ * Long Delay audio process
+ */
+void __not_in_flash_func(fx_lngdly_Proc)(void *vblk, int32_t *dst, int32_t *src, uint16_t sz)
+{
+	fx_lngdly_blk *blk = vblk;
+	uint32_t *buf = blk->dlybuf, wptr = blk->wptr, tap;
+	int32_t *lo = blk->lo, mix, l, r, a;
+	int16_t fb_lvl = fx_parm[2];
+	uint16_t i, n;
+	
+	/* update delay parameters if not already crossfading */
+	if(!blk->xfcnt)
+	{
+		uint8_t upd = 0;
+		
+		/* the ring keeps its contents so a rate change bends the pitch */
+		if(dsp_ratio_hyst_arb(&blk->div_raw, fx_parm[3], 1))
+			blk->mr.factor = 2<<blk->div_raw;
+		
+		if(blk->rate != fx_sample_rate)
+		{
+			blk->rate = fx_sample_rate;
+			upd = 1;
+		}
+		
+		if(dsp_gethyst(&blk->dly, fx_parm[1]) || upd)
+		{
+			blk->roff2 = fx_lngdly_delay(blk);
+			blk->xfcnt = 1<<LNG_XFADE_BITS;
+		}
+	}
+	
+	n = dsp_os_decimate(&blk->mr, lo, src, sz);
+	for(i=0;i<n;i++)
+	{
+		/* mix feedback into write buffer */
+		buf[wptr] = dsp_st_pack_ssat(
+			((lo[2*i]>>4) + blk->fb[0] * fb_lvl)>>12,
+			((lo[2*i+1]>>4) + blk->fb[1] * fb_lvl)>>12);
+		
+		/* get main tap */
+		tap = buf[(wptr - blk->roff1) & ((1<<LNG_BITS)-1)];
+		l = dsp_st_l(tap);
+		r = dsp_st_r(tap);
+		
+		/* process crossfade */
+		if(blk->xfcnt)
+		{
+			/* fade from main tap toward the new one, all the way by the last frame */
+			tap = buf[(wptr - blk->roff2) & ((1<<LNG_BITS)-1)];
+			a = (1<<LNG_XFADE_BITS) - blk->xfcnt + 1;
+			l += ((dsp_st_l(tap) - l) * a) >> LNG_XFADE_BITS;
+			r += ((dsp_st_r(tap) - r) * a) >> LNG_XFADE_BITS;
+			
+			blk->xfcnt--;
+			if(blk->xfcnt == 0)
+				blk->roff1 = blk->roff2;
+		}
+		
+		/* dc block on feedback */
+		mix = l - (blk->dcb[0]>>8);
+		blk->dcb[0] += mix;
+		blk->fb[0] = dsp_ssat16(mix);
+		mix = r - (blk->dcb[1]>>8);
+		blk->dcb[1] += mix;
+		blk->fb[1] = dsp_ssat16(mix);
+		
+		lo[2*i] = l<<16;
+		lo[2*i+1] = r<<16;
+		
+		wptr = (wptr+1) & ((1<<LNG_BITS)-1);
+	}
+	dsp_os_interpolate(&blk->mr, dst, lo, sz);
+	
+	blk->wptr = wptr;
+}
+
+/*
+ * Render parameter for long delay - delay in ms, feedback % or rate
+ */
+void fx_lngdly_Render_Parm(void *vblk, uint8_t idx)
+{
+	fx_lngdly_blk *blk = vblk;
+	char txtbuf[32];
+	GFX_RECT rect =
+	{
+		.x0 = 65,
+		.y0 = idx*10+10,
+		.x1 = 158,
+		.y1 = idx*10+17
+	};
+	
+	if(idx == 0)
+		return;
+	
+	switch(idx)
+	{
+		case 1:	// Delay
+			sprintf(txtbuf, "%6d ms ",
+				fx_lngdly_delay(blk) * blk->mr.factor * 1000 / blk->rate);
+			break;
+		
+		case 3: // Rate
+			sprintf(txtbuf, "%s ", lngdly_rates[blk->div_raw]);
+			fx_lngdly_Render_Parm(vblk, 1);	// update Delay too
+			break;
+		
+		case 2:	// Feedback
+		default:
+			sprintf(txtbuf, "%2d%% ", ADC_param[idx]/41);
+			break;
+	}
+	gfx_drawstrrect(&rect, txtbuf);
+}
+
+fx_struct fx_lngdly_struct =
+{
+	"LngDly",
+	3,
+	lngdly_param_names,
+	fx_lngdly_Init,
+	fx_bypass_Cleanup,
+	NULL,
+	fx_lngdly_Render_Parm,
+	fx_lngdly_Proc,
+	FX_MEM_ROUND(sizeof(fx_lngdly_blk)) + FX_MEM_ROUND((1<<LNG_BITS)*sizeof(uint32_t)),
+};
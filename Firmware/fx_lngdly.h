@@ -0,0 +1,13 @@
+/*
+ * fx_lngdly.h - Long Delay effect for RP2040_Audio
+ * 10-17-26 E. Brombaugh
+ */
+
+#ifndef __fx_lngdly__
+#define __fx_lngdly__
+
+#include "fx.h"
+
+extern fx_struct fx_lngdly_struct;
+
+#endif
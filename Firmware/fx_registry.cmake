@@ -0,0 +1,35 @@
+# fx_registry.cmake - generate fx_registry.h from the FX_EFFECTS list
+# The list is kept here by hand - a new effect is built in by adding it below.
+# Each entry is name:id for an fx_<name>_struct. The order sets the algo knob
+# order and bypass must be in the list. The id keys saved params in NVS so an
+# effect keeps its id for good and ids are never reused - 0 to 62.
+# FX_EFFECTS_OVERRIDE builds a variant with a different subset instead. The
+# list isn't cached so a build dir picks up changes here on its next configure.
+# An effect in its own fx_<name>.c is built from the list too, so adding one
+# is just the file and its entry here. FX_SOURCES holds the effect sources
+# for the firmware and host builds.
+if(DEFINED FX_EFFECTS_OVERRIDE)
+	set(FX_EFFECTS ${FX_EFFECTS_OVERRIDE})
+else()
+	set(FX_EFFECTS "bypass:0;vca:1;cdr:2;vcadly:3;tape:4;drive:5;lngdly:6;reverb:7")
+endif()
+
+# bypass is in fx.c, cdr in fx_cdl.c and the chains in fx_chain.c, which
+# always builds with the VCA and clean delay it chains
+set(FX_SOURCES fx.c fx_arena.c fx_vca.c fx_cdl.c fx_chain.c)
+
+set(FX_REGISTRY_TEXT "/* generated from FX_EFFECTS by fx_registry.cmake - do not edit */\n")
+foreach(FX_ENTRY ${FX_EFFECTS})
+	string(REPLACE ":" ";" FX_PAIR ${FX_ENTRY})
+	list(GET FX_PAIR 0 FX_NAME)
+	list(GET FX_PAIR 1 FX_ID)
+	string(APPEND FX_REGISTRY_TEXT "FX_REGISTER(fx_${FX_NAME}_struct, ${FX_ID})\n")
+	if(EXISTS ${CMAKE_CURRENT_LIST_DIR}/fx_${FX_NAME}.c)
+		list(APPEND FX_SOURCES fx_${FX_NAME}.c)
+	endif()
+endforeach()
+list(REMOVE_DUPLICATES FX_SOURCES)
+list(TRANSFORM FX_SOURCES PREPEND ${CMAKE_CURRENT_LIST_DIR}/)
+file(WRITE ${CMAKE_CURRENT_BINARY_DIR}/fx_registry.h.tmp ${FX_REGISTRY_TEXT})
+configure_file(${CMAKE_CURRENT_BINARY_DIR}/fx_registry.h.tmp
+	${CMAKE_CURRENT_BINARY_DIR}/fx_registry.h COPYONLY)
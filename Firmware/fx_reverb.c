@@ -0,0 +1,360 @@
+/*
+ * fx_reverb.c - FDN Reverb effect for RP2040_Audio
+ * 10-17-26 E. Brombaugh
+ *
+ * Eight delay lines fed back through a Hadamard matrix. Each line is read
+ * at a slowly modulated position to smear the modes, low-passed for the
+ * damping and scaled for the decay time before the matrix mixes them back
+ * in. The tank runs at half rate (quarter at 96k) through the dsp_os
+ * half-bands, which halves both its cycles and the ring memory - the lines
+ * hold 16-bit samples and together fill FX_MAX_MEM.
+ *
+ * Init times the tank on the target and if half rate wouldn't fit in
+ * RVB_SHARE of the frame at the current clock and sample rate the tank
+ * drops to quarter rate, so the budget rests on what the part measures
+ * rather than an estimate. The B benchmark gives the whole effect's cycles.
+ * Rate, clock and setting changes are picked up on core 1, so the gains and
+ * rate choice run from RAM and read clk_sys from fx_sys_hz.
+ */
+
+#include <stdlib.h>
+#include "fx_reverb.h"
+#include "audio.h"
+#include "dsp_os.h"
+#include "prof.h"
+
+#define RVB_LINES 8
+#define RVB_MOD_DEPTH 8			// line modulation, +/- slow frames
+#define RVB_LFO_STEP 89478		// modulation rate, 0.5Hz at 24k
+#define RVB_GLIDE 32			// fastest size change, Q8 frames per frame
+#define RVB_NORM 11585			// 1/sqrt(8) in Q15 for the Hadamard
+#define RVB_SHARE 50			// % of the cycles per frame the reverb may use
+#define RVB_CAL_FRAMES 32		// block the tank is timed on
+
+/* line lengths in slow frames, primes so the modes don't pile up - not const so Proc reads them from RAM */
+static uint16_t fx_reverb_len[RVB_LINES] =
+{
+	5779, 6271, 6833, 7393, 7993, 8543, 9127, 9733
+};
+#define RVB_TOTAL (5779+6271+6833+7393+7993+8543+9127+9733)
+
+/* 2^-(i/16) in Q15 - not const, fx_reverb_update runs on core 1 too */
+static int32_t fx_reverb_exp2[17] =
+{
+	32768, 31379, 30048, 28774, 27554, 26386, 25268, 24196,
+	23170, 22188, 21247, 20347, 19484, 18658, 17867, 17109, 16384
+};
+
+typedef struct
+{
+	dsp_os_state mr;		/* tank in and out */
+	int16_t *line[RVB_LINES];	/* delay lines */
+	uint16_t wptr[RVB_LINES];	/* write pointers */
+	int32_t dly[RVB_LINES];		/* read delay, Q8 slow frames */
+	int32_t target[RVB_LINES];	/* read delay for the Size setting */
+	int16_t gain[RVB_LINES];	/* decay per pass with the matrix scaling, Q15 */
+	int32_t lpf[RVB_LINES];		/* damping filter state */
+	uint32_t lfo;			/* modulation phase */
+	int16_t size, decay;	/* params w/ hysteresis */
+	uint32_t rate;			/* sample rate gains were computed for */
+	uint32_t hz;			/* clk_sys the tank rate was picked for */
+	uint8_t over;			/* tank doesn't fit RVB_SHARE even at quarter rate */
+	uint32_t tank_cyc;		/* measured tank cycles per slow frame, 0 on the host */
+	int32_t lo[2*DSP_OS_SLOW_MAX(SMPS_MAX)];	/* tank in and out */
+} fx_reverb_blk;
+
+static void fx_reverb_measure(fx_reverb_blk *blk);
+
+const char *reverb_param_names[] =
+{
+	"Size  ",
+	"Decay ",
+	"Damp  ",
+};
+
+/*
+ * decay time in ms for a Decay setting, 0.2 to 16.5 sec
+ */
+static uint32_t fx_reverb_rt60(int16_t decay)
+{
+	return 200 + ((decay * decay) >> 10);
+}
+
+/*
+ * line delays and gains for the Size and Decay settings - a line of n slow
+ * frames at fs needs 2^-(log2(1000) * n / (fs * rt60)) per pass
+ */
+static void __not_in_flash_func(fx_reverb_update)(fx_reverb_blk *blk)
+{
+	uint32_t fs = blk->rate / blk->mr.factor;
+	uint32_t rt = fx_reverb_rt60(blk->decay);
+	int32_t scale = 1024 + ((blk->size * 3072) >> 12);
+	int32_t x, f, g;
+	uint8_t k;
+	
+	for(k=0;k<RVB_LINES;k++)
+	{
+		blk->target[k] = ((fx_reverb_len[k] - RVB_MOD_DEPTH - 2) * scale) >> 4;
+		
+		/* exponent Q16, then 2^-x from the table */
+		x = ((int64_t)blk->target[k] * 2551245) / ((int64_t)fs * rt);
+		if((x>>16) > 15)
+			g = 0;
+		else
+		{
+			f = x & 0xffff;
+			g = fx_reverb_exp2[f>>12];
+			g += ((fx_reverb_exp2[(f>>12)+1] - g) * (f & 0xfff)) >> 12;
+			g >>= x>>16;
+		}
+		blk->gain[k] = (g * RVB_NORM) >> 15;
+	}
+}
+
+/*
+ * tank rate for the sample rate - about 24k whatever it is, or quarter rate
+ * if the tank's measured cost won't fit RVB_SHARE of the frame at half. If
+ * it doesn't fit at quarter either it runs anyway and over flags it for the
+ * display, since this may be on core 1 where nothing can be printed.
+ */
+static void __not_in_flash_func(fx_reverb_rate)(fx_reverb_blk *blk)
+{
+	uint32_t budget = fx_sys_hz / fx_sample_rate * RVB_SHARE / 100;
+	uint8_t factor = fx_sample_rate > 48000 ? 4 : 2;
+	
+	if((factor == 2) && (dsp_os_mr_cyc[1] + blk->tank_cyc/2 > budget))
+		factor = 4;
+	blk->over = dsp_os_mr_cyc[factor/2] + blk->tank_cyc/factor > budget;
+	
+	blk->rate = fx_sample_rate;
+	blk->hz = fx_sys_hz;
+	dsp_os_init(&blk->mr, factor);
+}
+
+/*
+ * clear the tank and start from the Size and Decay minimum
+ */
+static void fx_reverb_reset(fx_reverb_blk *blk)
+{
+	uint8_t k;
+	
+	memset(blk->line[0], 0, RVB_TOTAL*sizeof(int16_t));
+	for(k=0;k<RVB_LINES;k++)
+	{
+		blk->wptr[k] = 0;
+		blk->lpf[k] = 0;
+	}
+	
+	blk->lfo = 0;
+	blk->size = 0;
+	blk->decay = 0;
+	fx_reverb_rate(blk);
+	fx_reverb_update(blk);
+	for(k=0;k<RVB_LINES;k++)
+		blk->dly[k] = blk->target[k];
+}
+
+/*
+ * Reverb init
+ */
+void * fx_reverb_Init(void)
+{
+	fx_reverb_blk *blk = fx_alloc(sizeof(fx_reverb_blk), 4, FX_BANK_ANY, "Reverb");
+	int16_t *buf;
+	uint8_t k;
+	
+	if(blk == NULL)
+		return NULL;
+	
+	/* one allocation for all the lines */
+	buf = fx_alloc(RVB_TOTAL*sizeof(int16_t), 4, FX_BANK_ANY, "Reverb lines");
+	if(buf == NULL)
+		return NULL;
+	for(k=0;k<RVB_LINES;k++)
+	{
+		blk->line[k] = buf;
+		buf += fx_reverb_len[k];
+	}
+	
+	/* time the tank at half rate, then start over silent at the rate it fits */
+	blk->tank_cyc = 0;
+	fx_reverb_reset(blk);
+	fx_reverb_measure(blk);
+	fx_reverb_reset(blk);
+	if(blk->over)
+		printf("fx_reverb_Init: tank needs %u cycles/frame at 1/%d rate, over RVB_SHARE\n",
+			dsp_os_mr_cyc[blk->mr.factor/2] + blk->tank_cyc/blk->mr.factor, blk->mr.factor);
+	
+	return (void *)blk;
+}
+
+/*
+ * Reverb audio process
+ */
+void __not_in_flash_func(fx_reverb_Proc)(void *vblk, int32_t *dst, int32_t *src, uint16_t sz)
+{
+	fx_reverb_blk *blk = vblk;
+	int32_t *lo = blk->lo, v[RVB_LINES], x, t, d, a, b, l, r;
+	int32_t damp = 32767 - ((fx_parm[3] * 28000) >> 12);
+	int16_t *line;
+	uint16_t i, n, len;
+	uint8_t k, upd = 0;
+	
+	/* new gains when the settings, rate or clock change */
+	if((blk->rate != fx_sample_rate) || (blk->hz != fx_sys_hz))
+	{
+		fx_reverb_rate(blk);
+		upd = 1;
+	}
+	upd |= dsp_gethyst(&blk->size, fx_parm[1]);
+	upd |= dsp_gethyst(&blk->decay, fx_parm[2]);
+	if(upd)
+		fx_reverb_update(blk);
+	
+	n = dsp_os_decimate(&blk->mr, lo, src, sz);
+	for(i=0;i<n;i++)
+	{
+		blk->lfo += RVB_LFO_STEP;
+		l = r = 0;
+		for(k=0;k<RVB_LINES;k++)
+		{
+			/* glide toward the size setting */
+			d = blk->target[k] - blk->dly[k];
+			d = d > RVB_GLIDE ? RVB_GLIDE : d;
+			d = d < -RVB_GLIDE ? -RVB_GLIDE : d;
+			blk->dly[k] += d;
+			
+			/* triangle modulation, each line an eighth of a cycle on */
+			t = blk->lfo + ((uint32_t)k<<29);
+			t = ((t ^ (t>>31)) >> 15) - 32768;
+			d = blk->dly[k] + ((t * RVB_MOD_DEPTH) >> 7);
+			
+			/* linear interpolated read between d and d+1 frames back */
+			line = blk->line[k];
+			len = fx_reverb_len[k];
+			t = blk->wptr[k] - (d>>8);
+			t = t < 0 ? t + len : t;
+			a = line[t];
+			t = t ? t-1 : len-1;
+			b = line[t];
+			x = a + (((b - a) * (d & 0xff)) >> 8);
+			
+			/* damping and decay */
+			blk->lpf[k] += ((x - blk->lpf[k]) * damp + (1<<14)) >> 15;
+			x = blk->lpf[k];
+			v[k] = (x * blk->gain[k] + (1<<14)) >> 15;
+			
+			/* taps for the outputs, alternate lines to each side */
+			if(k&1)
+				r += (k&2) ? -x : x;
+			else
+				l += (k&2) ? -x : x;
+		}
+		
+		/* Hadamard mix - three stages of butterflies */
+		for(k=0;k<RVB_LINES;k+=2)
+		{
+			a = v[k]; b = v[k+1];
+			v[k] = a + b; v[k+1] = a - b;
+		}
+		for(k=0;k<RVB_LINES;k+=4)
+		{
+			a = v[k]; b = v[k+2]; v[k] = a + b; v[k+2] = a - b;
+			a = v[k+1]; b = v[k+3]; v[k+1] = a + b; v[k+3] = a - b;
+		}
+		for(k=0;k<RVB_LINES/2;k++)
+		{
+			a = v[k]; b = v[k+4];
+			v[k] = a + b; v[k+4] = a - b;
+		}
+		
+		/* feed the input in, left to even lines and right to odd */
+		a = lo[2*i] >> 18;
+		b = lo[2*i+1] >> 18;
+		for(k=0;k<RVB_LINES;k++)
+		{
+			x = v[k] + ((k&1) ? b : a);
+			blk->line[k][blk->wptr[k]] = dsp_ssat16(x);
+			blk->wptr[k] = blk->wptr[k]+1 < fx_reverb_len[k] ? blk->wptr[k]+1 : 0;
+		}
+		
+		lo[2*i] = dsp_ssat16(l) << 16;
+		lo[2*i+1] = dsp_ssat16(r) << 16;
+	}
+	dsp_os_interpolate(&blk->mr, dst, lo, sz);
+}
+
+/*
+ * time the tank on silent blocks with SysTick on this core - the fastest of
+ * a few runs, less the half rate ends. SysTick doesn't count on the host.
+ */
+static void fx_reverb_measure(fx_reverb_blk *blk)
+{
+#if PICO_ON_DEVICE
+	int32_t *buf = calloc(4*RVB_CAL_FRAMES, sizeof(int32_t));
+	uint32_t t, best = PROF_MASK;
+	uint8_t i;
+	
+	if(!buf)
+		return;
+	
+	dsp_os_init(&blk->mr, 2);
+	prof_start();
+	for(i=0;i<4;i++)
+	{
+		t = prof_now();
+		fx_reverb_Proc(blk, &buf[2*RVB_CAL_FRAMES], buf, RVB_CAL_FRAMES);
+		t = (t - prof_now()) & PROF_MASK;
+		best = t < best ? t : best;
+	}
+	free(buf);
+	
+	best /= RVB_CAL_FRAMES;
+	blk->tank_cyc = best > dsp_os_mr_cyc[1] ? 2*(best - dsp_os_mr_cyc[1]) : 0;
+#endif
+}
+
+/*
+ * Render parameter for reverb - size % with the tank rate, marked if it's
+ * over budget, decay time or damping %
+ */
+void fx_reverb_Render_Parm(void *vblk, uint8_t idx)
+{
+	fx_reverb_blk *blk = vblk;
+	char txtbuf[32];
+	uint32_t rt;
+	GFX_RECT rect =
+	{
+		.x0 = 65,
+		.y0 = idx*10+10,
+		.x1 = 158,
+		.y1 = idx*10+17
+	};
+	
+	if(idx == 0)
+		return;
+	
+	if(idx == 2)
+	{
+		rt = fx_reverb_rt60(ADC_param[2]);
+		sprintf(txtbuf, "%2d.%1d s ", rt/1000, (rt/100)%10);
+	}
+	else if(idx == 1)
+		sprintf(txtbuf, "%2d%% 1/%d%s ", ADC_param[idx]/41, blk->mr.factor, blk->over ? "!" : "");
+	else
+		sprintf(txtbuf, "%2d%% ", ADC_param[idx]/41);
+	gfx_drawstrrect(&rect, txtbuf);
+}
+
+fx_struct fx_reverb_struct =
+{
+	"Reverb",
+	3,
+	reverb_param_names,
+	fx_reverb_Init,
+	fx_bypass_Cleanup,
+	NULL,
+	fx_reverb_Render_Parm,
+	fx_reverb_Proc,
+	FX_MEM_ROUND(sizeof(fx_reverb_blk)) + FX_MEM_ROUND(RVB_TOTAL*sizeof(int16_t)),
+};
@@ -0,0 +1,13 @@
+/*
+ * fx_reverb.h - FDN Reverb effect for RP2040_Audio
+ * 10-17-26 E. Brombaugh
+ */
+
+#ifndef __fx_reverb__
+#define __fx_reverb__
+
+#include "fx.h"
+
+extern fx_struct fx_reverb_struct;
+
+#endif
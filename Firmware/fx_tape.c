@@ -0,0 +1,215 @@
+/*
+ * fx_tape.c - Tape Delay effect for RP2040_Audio
+ * 10-17-26 E. Brombaugh
+ *
+ * The read head glides toward the delay set by the control at a limited
+ * speed, so time changes bend the pitch like tape instead of crossfading
+ * between taps. The head sits between frames, so it's read through a
+ * polyphase windowed sinc built from dblfilter.h. At the default 8 taps it's
+ * flat to about 0.25fs, 3dB down at 0.39fs and only 9.5dB down at fs/2, so
+ * it has no margin for a head running faster than 1x - everything above
+ * fs/2 over the speed folds back down. The head may slow to half speed to
+ * lengthen the delay but only speeds up by 1/16 to shorten it, which folds
+ * just the top 6% of the band where the filter already has it 7dB down.
+ */
+
+#include "fx_tape.h"
+#include "dblfilter.h"
+
+#define TAPE_BITS 14		// delay buffer length in frames
+#define TAPE_TAPS 8			// interpolator taps - 4, 8 or 12 to fit the block budget
+#define TAPE_PHASES 256		// interpolator phases - fixed by the table
+#define TAPE_SMOOTH 10		// head glide time constant, 2^n frames
+#define TAPE_MAX_STEP 32768	// largest head speed deviation from 1x, Q16
+#define TAPE_MAX_FAST 4096	// largest head speed up over 1x, Q16
+
+typedef struct 
+{
+	uint32_t *dlybuf;		/* delay buffer */
+	int16_t *coef;			/* interpolator, TAPE_TAPS per phase */
+	uint32_t wptr;			/* write pointer */
+	int32_t dly;			/* head delay, Q16 frames */
+	int32_t dcb[2];			/* dc block on feedback */
+	int16_t fb[2];
+} fx_tape_blk;
+
+const char *tape_param_names[] =
+{
+	"DlyAmt",
+	"Feedbk",
+	"Slew  ",
+};
+
+/*
+ * Tape Delay init
+ */
+void * fx_tape_Init(void)
+{
+	fx_tape_blk *blk = fx_alloc(sizeof(fx_tape_blk), 4, FX_BANK_FAST, "Tape");
+	int32_t sum, tap[TAPE_TAPS];
+	int64_t x, span = (TAPE_TAPS/2*TAPE_PHASES)*(TAPE_TAPS/2*TAPE_PHASES);
+	uint16_t p, k;
+	const short *h;
+	
+	if(blk == NULL)
+		return NULL;
+	
+	/* delay buffer cleared so unwritten frames read as silence */
+	blk->dlybuf = fx_alloc((1<<TAPE_BITS)*sizeof(uint32_t), 4, FX_BANK_ANY, "Tape ring");
+	if(blk->dlybuf == NULL)
+		return NULL;
+	memset(blk->dlybuf, 0, (1<<TAPE_BITS)*sizeof(uint32_t));
+	
+	/*
+	 * interpolator - the center TAPE_TAPS of each phase, reordered to run
+	 * along the taps and scaled to unity gain at DC. Phase p is the head
+	 * p/256 of a frame past the tap before the center.
+	 */
+	blk->coef = fx_alloc(TAPE_PHASES*TAPE_TAPS*sizeof(int16_t), 4, FX_BANK_ANY, "Tape coef");
+	if(blk->coef == NULL)
+		return NULL;
+	for(p=0;p<TAPE_PHASES;p++)
+	{
+		h = &MY_FILTER_IMP[(6-TAPE_TAPS/2)*TAPE_PHASES + TAPE_PHASES-1 - p];
+		sum = 0;
+		for(k=0;k<TAPE_TAPS;k++)
+		{
+			tap[k] = h[k*TAPE_PHASES];
+#if TAPE_TAPS < 12
+			/*
+			 * cut down to fewer taps the response would differ from phase
+			 * to phase and modulate a moving head - taper it to 0 over the
+			 * shorter span with (1-x^2)^2 so it stays smooth
+			 */
+			x = (int32_t)((k-(TAPE_TAPS/2-1))*TAPE_PHASES - p);
+			x = x*x;
+			tap[k] = tap[k] * (span-x) / span * (span-x) / span;
+#endif
+			sum += tap[k];
+		}
+		for(k=0;k<TAPE_TAPS;k++)
+			blk->coef[p*TAPE_TAPS+k] = ((tap[k]<<15) + sum/2) / sum;
+	}
+	
+	blk->wptr = 0;
+	blk->dly = (TAPE_TAPS/2+1)<<16;
+	blk->dcb[0] = blk->dcb[1] = 0;
+	blk->fb[0] = blk->fb[1] = 0;
+	
+	return (void *)blk;
+}
+
+/*
+ * delay the head heads for, in frames, for a DlyAmt setting - the control is
+ * scaled so the time is the same at any rate, limited by the buffer length
+ */
+static int32_t fx_tape_delay(int16_t amt)
+{
+	int32_t dly = ((amt<<2) * fx_sample_rate) / SAMPLE_RATE;
+	
+	dly = dly < TAPE_TAPS/2+1 ? TAPE_TAPS/2+1 : dly;
+	return dly > (1<<TAPE_BITS)-TAPE_TAPS ? (1<<TAPE_BITS)-TAPE_TAPS : dly;
+}
+
+/*
+ * Tape Delay audio process
+ */
+void __not_in_flash_func(fx_tape_Proc)(void *vblk, int16_t *dst, int16_t *src, uint16_t sz)
+{
+	fx_tape_blk *blk = vblk;
+	uint32_t *buf = blk->dlybuf, *s = (uint32_t *)src, *d = (uint32_t *)dst;
+	uint32_t wptr = blk->wptr, pos, idx, in, tap;
+	int32_t dly = blk->dly, target, step, max_step, max_fast, mix, l, r;
+	int16_t fb_lvl = fx_parm[2], *c;
+	uint16_t i, k;
+	
+	/* head target and how fast it may change speed */
+	target = fx_tape_delay(fx_parm[1])<<16;
+	max_step = ((fx_parm[3]>>4)+1)*((fx_parm[3]>>4)+1)/2;
+	max_step = max_step < 1 ? 1 : max_step;		// still creeps at the bottom of Slew
+	max_step = max_step > TAPE_MAX_STEP ? TAPE_MAX_STEP : max_step;
+	max_fast = max_step > TAPE_MAX_FAST ? TAPE_MAX_FAST : max_step;
+	
+	for(i=0;i<sz;i++)
+	{
+		/* mix feedback into write buffer */
+		in = *s++;
+		buf[wptr] = dsp_st_pack_ssat(
+			((dsp_st_l(in)<<12) + blk->fb[0] * fb_lvl)>>12,
+			((dsp_st_r(in)<<12) + blk->fb[1] * fb_lvl)>>12);
+		
+		/* glide the head toward the target, shortening the delay speeds it up */
+		step = (target - dly)>>TAPE_SMOOTH;
+		step = step > max_step ? max_step : step;
+		step = step < -max_fast ? -max_fast : step;
+		dly += step;
+		
+		/* head position rounded to a phase, the taps straddle it */
+		pos = (wptr<<16) - dly + (1<<7);
+		idx = (pos>>16) - (TAPE_TAPS/2-1);
+		c = &blk->coef[((pos>>8)&(TAPE_PHASES-1))*TAPE_TAPS];
+		l = r = 1<<14;
+		for(k=0;k<TAPE_TAPS;k++)
+		{
+			tap = buf[(idx+k) & ((1<<TAPE_BITS)-1)];
+			l += dsp_st_l(tap) * c[k];
+			r += dsp_st_r(tap) * c[k];
+		}
+		l >>= 15;
+		r >>= 15;
+		
+		/* dc block on feedback */
+		mix = l - (blk->dcb[0]>>8); 
+		blk->dcb[0] += mix;
+		blk->fb[0] = dsp_ssat16(mix);
+		mix = r - (blk->dcb[1]>>8); 
+		blk->dcb[1] += mix;
+		blk->fb[1] = dsp_ssat16(mix);
+		
+		/* output - the sinc can overshoot a little */
+		*d++ = dsp_st_pack_ssat(l, r);
+		
+		wptr = (wptr+1) & ((1<<TAPE_BITS)-1);
+	}
+	
+	blk->wptr = wptr;
+	blk->dly = dly;
+}
+
+/*
+ * Render parameter for tape delay - target delay in ms, feedback or slew %
+ */
+void fx_tape_Render_Parm(void *vblk, uint8_t idx)
+{
+	char txtbuf[32];
+	GFX_RECT rect =
+	{
+		.x0 = 65,
+		.y0 = idx*10+10,
+		.x1 = 158,
+		.y1 = idx*10+17
+	};
+	
+	if(idx == 0)
+		return;
+	
+	if(idx == 1)
+		sprintf(txtbuf, "%6d ms ", fx_tape_delay(ADC_param[1]) * 1000 / fx_sample_rate);
+	else
+		sprintf(txtbuf, "%2d%% ", ADC_param[idx]/41);
+	gfx_drawstrrect(&rect, txtbuf);
+}
+
+fx_struct fx_tape_struct =
+{
+	"TapeDly",
+	3,
+	tape_param_names,
+	fx_tape_Init,
+	fx_bypass_Cleanup,
+	fx_tape_Proc,
+	fx_tape_Render_Parm,
+	NULL,
+	FX_MEM_ROUND(sizeof(fx_tape_blk)) + FX_MEM_ROUND((1<<TAPE_BITS)*sizeof(uint32_t)) +
+		FX_MEM_ROUND(TAPE_PHASES*TAPE_TAPS*sizeof(int16_t)),
+};
@@ -0,0 +1,13 @@
+/*
+ * fx_tape.h - Tape Delay effect for RP2040_Audio
+ * 10-17-26 E. Brombaugh
+ */
+
+#ifndef __fx_tape__
+#define __fx_tape__
+
+#include "fx.h"
+
+extern fx_struct fx_tape_struct;
+
+#endif
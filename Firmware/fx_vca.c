@@ -20,10 +20,13 @@ const char *vca_param_names[] =
 /*
  * VCA init
  */
-void * fx_vca_Init(uint32_t *mem)
+void * fx_vca_Init(void)
 {
-	/* set up instance in mem area provided */
-	fx_vca_blk *blk = 	(fx_vca_blk *)mem;
+	/* set up instance - small and touched every sample so keep it near the audio core */
+	fx_vca_blk *blk = fx_alloc(sizeof(fx_vca_blk), 4, FX_BANK_FAST, "VCA");
+	
+	if(blk == NULL)
+		return NULL;
 	
 	/* initialize gain slewing */
 	blk->gain = 0;
@@ -35,25 +38,23 @@ void * fx_vca_Init(uint32_t *mem)
 /*
  * VCA audio process
  */
-void __not_in_flash_func(fx_vca_Proc)(void *vblk, int16_t *dst, int16_t *src, uint16_t sz)
+void __not_in_flash_func(fx_vca_Proc)(void *vblk, int32_t *dst, int32_t *src, uint16_t sz)
 {
 	fx_vca_blk *blk = vblk;
-	int16_t next_gain, gain_slope;
-	int32_t mix;
+	int16_t next_gain, gain_slope, gain = blk->gain;
 	
 	/* get the gain value & calc slew */
-	next_gain = ADC_param[1];
+	next_gain = fx_parm[1];
 	gain_slope = (next_gain - blk->gain)/sz;
 	
-	/* loop over the buffer */
+	/* loop over the buffer - gain is never more than 1.0 so no saturation */
 	while(sz--)
 	{
-		mix = *src++ * blk->gain;
-		*dst++ = dsp_ssat16(mix>>12);
-		mix = *src++ * blk->gain;
-		*dst++ = dsp_ssat16(mix>>12);
-		blk->gain += gain_slope;
+		*dst++ = dsp_mul32(*src++, gain, 12);
+		*dst++ = dsp_mul32(*src++, gain, 12);
+		gain += gain_slope;
 	}
+	blk->gain = gain;
 }
 
 fx_struct fx_vca_struct =
@@ -63,7 +64,9 @@ fx_struct fx_vca_struct =
 	vca_param_names,
 	fx_vca_Init,
 	fx_bypass_Cleanup,
-	fx_vca_Proc,
+	NULL,
 	fx_bypass_Render_Parm,
+	fx_vca_Proc,
+	FX_MEM_ROUND(sizeof(fx_vca_blk)),
 };
 
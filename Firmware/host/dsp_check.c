@@ -0,0 +1,551 @@
+/*
+ * dsp_check.c - packed stereo and 32-bit kernels against plain scalar code
+ * 10-17-26 E. Brombaugh
+ *
+ * usage: dsp_check
+ *
+ * Runs the dsp_lib packed stereo and 32-bit gain primitives, the VCA, the
+ * clean delay and the output kernels over random data mixed with full scale
+ * and zero values, and compares every result with a plain per-channel
+ * version written the way the code was before it was packed. Prints PASS or
+ * FAIL with the first mismatch for each and returns 1 if any failed.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include "fx.h"
+#include "fx_vca.h"
+#include "fx_cdl.h"
+#include "audio.h"
+#include "audio_out.h"
+
+#define CHK_RUNS 200000			// random cases per primitive
+#define CHK_BLOCKS 4000			// random blocks per kernel
+#define CHK_DLY_BITS 15			// clean delay ring, as fx_cdl.c
+#define CHK_XFADE_BITS 10
+
+static uint32_t chk_mem[FX_MAX_MEM/sizeof(uint32_t)];
+static int32_t chk_src[2*SMPS_MAX], chk_dst[2*SMPS_MAX], chk_ref[2*SMPS_MAX];
+
+/* first mismatch of the current check and how many there were */
+static char chk_first[200];
+static uint32_t chk_errs;
+
+/**************************************************************************/
+/******************* stimulus *********************************************/
+/**************************************************************************/
+
+static uint32_t chk_rnd = 0x12345678;
+
+/* xorshift */
+static uint32_t chk_rand(void)
+{
+	chk_rnd ^= chk_rnd << 13;
+	chk_rnd ^= chk_rnd >> 17;
+	chk_rnd ^= chk_rnd << 5;
+	return chk_rnd;
+}
+
+/* 16-bit samples that find saturation and sign mistakes */
+static const int16_t chk_edge16[] =
+{
+	0, 1, -1, 32767, -32767, -32768, 16384, -16384
+};
+
+/* 24-bit samples left justified as the codec gives them */
+static const int32_t chk_edge32[] =
+{
+	0, 0x100, -0x100, 0x7fffff00, -0x7fffff00, INT32_MIN, 0x40000000, -0x40000000
+};
+
+/* 16-bit sample, an edge case one time in four */
+static int16_t chk_s16(void)
+{
+	uint32_t r = chk_rand();
+	
+	if(!(r & 3))
+		return chk_edge16[(r >> 2) % (sizeof(chk_edge16)/sizeof(int16_t))];
+	return r >> 16;
+}
+
+/* 24-bit sample, an edge case one time in four */
+static int32_t chk_s32(void)
+{
+	uint32_t r = chk_rand();
+	
+	if(!(r & 3))
+		return chk_edge32[(r >> 2) % (sizeof(chk_edge32)/sizeof(int32_t))];
+	return (int32_t)chk_rand() & ~0xff;
+}
+
+/* value for a saturating pack - anywhere within 2^30, often near the limits */
+static int32_t chk_wide(void)
+{
+	uint32_t r = chk_rand();
+	
+	if(!(r & 3))
+		return (int32_t)((r >> 2) & 7) - 4 + ((r & 0x20) ? 32768 : -32768);
+	return (int32_t)chk_rand() >> (1 + (r >> 2) % 16);
+}
+
+/**************************************************************************/
+/******************* reporting ********************************************/
+/**************************************************************************/
+
+/*
+ * count a mismatch, keeping the first for the report
+ */
+static void chk_miss(const char *fmt, ...)
+{
+	va_list ap;
+	
+	if(!chk_errs++)
+	{
+		va_start(ap, fmt);
+		vsnprintf(chk_first, sizeof(chk_first), fmt, ap);
+		va_end(ap);
+	}
+}
+
+/*
+ * report a check and start the next - returns 1 if it failed
+ */
+static int chk_done(const char *name)
+{
+	uint32_t errs = chk_errs;
+	
+	chk_errs = 0;
+	if(!errs)
+	{
+		printf("PASS %s\n", name);
+		return 0;
+	}
+	
+	printf("FAIL %s: %u mismatches, first %s\n", name, errs, chk_first);
+	return 1;
+}
+
+/*
+ * compare a block of interleaved samples
+ */
+static void chk_block(const char *what, uint32_t blk, int32_t *got, int32_t *exp,
+	uint16_t len)
+{
+	uint16_t i;
+	
+	for(i=0;i<len;i++)
+		if(got[i] != exp[i])
+		{
+			chk_miss("%s block %u frame %u %s got 0x%08x expected 0x%08x", what,
+				blk, i/2, i&1 ? "R" : "L", got[i], exp[i]);
+			return;
+		}
+}
+
+/**************************************************************************/
+/******************* scalar references ************************************/
+/**************************************************************************/
+
+static int32_t ref_sat16(int32_t x)
+{
+	if(x > 32767)
+		return 32767;
+	if(x < -32768)
+		return -32768;
+	return x;
+}
+
+/* rectify and hold as level_calc() did */
+static uint16_t ref_peak(uint16_t level, int16_t sig)
+{
+	uint16_t rect = (sig < 0) ? -sig : sig;
+	
+	return level < rect ? rect : level;
+}
+
+static uint32_t ref_pack(int32_t l, int32_t r)
+{
+	return (uint16_t)l | ((uint32_t)(uint16_t)r << 16);
+}
+
+/**************************************************************************/
+/******************* primitives *******************************************/
+/**************************************************************************/
+
+/*
+ * packed stereo primitives against one channel at a time
+ */
+static int chk_st(void)
+{
+	uint32_t i, in, a, b, pk, got, exp;
+	int32_t l, r, g, gb;
+	uint8_t shift;
+	int fails = 0;
+	
+	for(i=0;i<CHK_RUNS;i++)
+	{
+		l = chk_wide();
+		r = chk_wide();
+		got = dsp_st_pack_ssat(l, r);
+		exp = ref_pack(ref_sat16(l), ref_sat16(r));
+		if(got != exp)
+			chk_miss("(%d, %d) got 0x%08x expected 0x%08x", l, r, got, exp);
+	}
+	fails += chk_done("dsp_st_pack_ssat");
+	
+	for(i=0;i<CHK_RUNS;i++)
+	{
+		in = ref_pack(chk_s16(), chk_s16());
+		g = chk_s16();
+		shift = chk_rand() % 16;
+		got = dsp_st_gain(in, g, shift);
+		exp = ref_pack(ref_sat16(((int16_t)in * g) >> shift),
+			ref_sat16(((int16_t)(in >> 16) * g) >> shift));
+		if(got != exp)
+			chk_miss("(0x%08x, %d, %u) got 0x%08x expected 0x%08x", in, g, shift,
+				got, exp);
+	}
+	fails += chk_done("dsp_st_gain");
+	
+	/* gains within 2^14 so the sum of products can't leave 32 bits */
+	for(i=0;i<CHK_RUNS;i++)
+	{
+		a = ref_pack(chk_s16(), chk_s16());
+		b = ref_pack(chk_s16(), chk_s16());
+		g = chk_s16() / 2;
+		gb = chk_s16() / 2;
+		shift = chk_rand() % 16;
+		got = dsp_st_mix(a, g, b, gb, shift);
+		exp = ref_pack(ref_sat16(((int16_t)a * g + (int16_t)b * gb) >> shift),
+			ref_sat16(((int16_t)(a >> 16) * g + (int16_t)(b >> 16) * gb) >> shift));
+		if(got != exp)
+			chk_miss("(0x%08x, %d, 0x%08x, %d, %u) got 0x%08x expected 0x%08x",
+				a, g, b, gb, shift, got, exp);
+	}
+	fails += chk_done("dsp_st_mix");
+	
+	for(i=0;i<CHK_RUNS;i++)
+	{
+		pk = (chk_rand() & 3) ? ref_pack(chk_rand() % 32769, chk_rand() % 32769) : 0;
+		in = ref_pack(chk_s16(), chk_s16());
+		got = dsp_st_peak(pk, in);
+		exp = ref_peak(pk & 0xffff, in) | (ref_peak(pk >> 16, in >> 16) << 16);
+		if(got != exp)
+			chk_miss("(0x%08x, 0x%08x) got 0x%08x expected 0x%08x", pk, in, got, exp);
+	}
+	fails += chk_done("dsp_st_peak");
+	
+	return fails;
+}
+
+/*
+ * 32-bit gains against 64-bit products, over the range they're specified
+ * for - gains below 1.0 so the result fits
+ */
+static int chk_32(void)
+{
+	uint32_t i;
+	int32_t x, y, g, gb, got, exp;
+	uint8_t shift;
+	int fails = 0;
+	
+	for(i=0;i<CHK_RUNS;i++)
+	{
+		x = chk_s32();
+		shift = 1 + chk_rand() % 16;
+		g = (chk_rand() & 1) ? (1 << shift) - 1 : chk_rand() % (1 << shift);
+		got = dsp_mul32(x, g, shift);
+		exp = ((int64_t)x * g) >> shift;
+		if(got != exp)
+			chk_miss("(0x%08x, %d, %u) got 0x%08x expected 0x%08x", x, g, shift,
+				got, exp);
+	}
+	fails += chk_done("dsp_mul32");
+	
+	for(i=0;i<CHK_RUNS;i++)
+	{
+		x = chk_s32();
+		y = chk_s32();
+		shift = 1 + chk_rand() % 16;
+		g = chk_rand() % (1 << shift);
+		gb = (chk_rand() & 1) ? (1 << shift) - 1 - g : chk_rand() % ((1 << shift) - g);
+		got = dsp_mix32(x, g, y, gb, shift);
+		exp = ((int64_t)x * g + (int64_t)y * gb) >> shift;
+		if(got != exp)
+			chk_miss("(0x%08x, %d, 0x%08x, %d, %u) got 0x%08x expected 0x%08x",
+				x, g, y, gb, shift, got, exp);
+	}
+	fails += chk_done("dsp_mix32");
+	
+	return fails;
+}
+
+/**************************************************************************/
+/******************* kernels **********************************************/
+/**************************************************************************/
+
+/*
+ * block size - the runtime range with the odd sizes too
+ */
+static uint16_t chk_len(void)
+{
+	return SMPS_MIN + chk_rand() % (SMPS_MAX - SMPS_MIN + 1);
+}
+
+/*
+ * init an effect in a fresh arena
+ */
+static void *chk_init(const fx_struct *effect)
+{
+	void *blk;
+	
+	fx_arena_init(chk_mem, sizeof(chk_mem));
+	fx_arena_begin(0, FX_ALGO_fx_bypass_struct, effect->mem_size);
+	blk = effect->init();
+	fx_arena_end();
+	return blk;
+}
+
+/*
+ * VCA with gain slewing across each block
+ */
+static int chk_vca(void)
+{
+	void *blk = chk_init(&fx_vca_struct);
+	int16_t gain = 0, slope;
+	uint32_t n;
+	uint16_t i, len;
+	
+	for(n=0;n<CHK_BLOCKS;n++)
+	{
+		len = chk_len();
+		ADC_param[1] = (chk_rand() & 3) ? chk_rand() % 4096 : (chk_rand() & 1) * 4095;
+		for(i=0;i<2*len;i++)
+			chk_src[i] = chk_s32();
+		fx_vca_struct.proc32(blk, chk_dst, chk_src, len);
+		
+		slope = (ADC_param[1] - gain) / len;
+		for(i=0;i<len;i++)
+		{
+			chk_ref[2*i] = ((int64_t)chk_src[2*i] * gain) >> 12;
+			chk_ref[2*i+1] = ((int64_t)chk_src[2*i+1] * gain) >> 12;
+			gain += slope;
+		}
+		chk_block("VCA", n, chk_dst, chk_ref, 2*len);
+	}
+	
+	return chk_done("VCA");
+}
+
+/*
+ * clean delay with realtime range, one channel at a time and a straight
+ * blend for the crossfade - state as fx_cdr_Init() leaves it
+ */
+typedef struct
+{
+	int16_t buf[2][1<<CHK_DLY_BITS];
+	uint32_t w, roff1, roff2;
+	uint16_t rng_raw, xfcnt;
+	uint8_t rng;
+	int16_t dly;
+	uint32_t rate;
+	int32_t dcb[2];
+	int16_t fb[2];
+} ref_cdl_state;
+
+static ref_cdl_state ref_cdl;
+
+static void ref_cdl_proc(int16_t *dst, int16_t *src, uint16_t sz)
+{
+	ref_cdl_state *s = &ref_cdl;
+	uint32_t mask = (1<<CHK_DLY_BITS)-1, d;
+	int32_t tap[2], nxt, mix, a;
+	uint16_t i;
+	uint8_t c, upd;
+	
+	if(!s->xfcnt)
+	{
+		upd = dsp_ratio_hyst_arb(&s->rng_raw, fx_parm[3], 2);
+		s->rng = 1 + s->rng_raw;
+		if(s->rate != fx_sample_rate)
+		{
+			s->rate = fx_sample_rate;
+			upd = 1;
+		}
+		if(dsp_gethyst(&s->dly, fx_parm[1]) || upd)
+		{
+			d = ((s->dly << s->rng) * s->rate) / SAMPLE_RATE + 1;
+			s->roff2 = d > mask-1 ? mask-1 : d;
+			s->xfcnt = 1<<CHK_XFADE_BITS;
+		}
+	}
+	
+	for(i=0;i<sz;i++)
+	{
+		for(c=0;c<2;c++)
+		{
+			s->buf[c][s->w] = ref_sat16(((src[2*i+c] << 12) + s->fb[c] * fx_parm[2]) >> 12);
+			tap[c] = s->buf[c][(s->w - s->roff1) & mask];
+			if(s->xfcnt)
+			{
+				nxt = s->buf[c][(s->w - s->roff2) & mask];
+				a = ((1<<CHK_XFADE_BITS) - s->xfcnt + 1) >> (CHK_XFADE_BITS-8);
+				tap[c] = s->xfcnt == 1 ? nxt : tap[c] + (((nxt - tap[c]) * a) >> 8);
+			}
+			mix = tap[c] - (s->dcb[c] >> 8);
+			s->dcb[c] += mix;
+			s->fb[c] = ref_sat16(mix);
+			dst[2*i+c] = tap[c];
+		}
+		if(s->xfcnt && !--s->xfcnt)
+			s->roff1 = s->roff2;
+		s->w = (s->w + 1) & mask;
+	}
+}
+
+static int chk_cdl(void)
+{
+	void *blk = chk_init(&fx_cdr_struct);
+	int16_t *src = (int16_t *)chk_src, *dst = (int16_t *)chk_dst;
+	int16_t *ref = (int16_t *)chk_ref;
+	int32_t p;
+	uint32_t n;
+	uint16_t i, len;
+	
+	memset(&ref_cdl, 0, sizeof(ref_cdl));
+	ref_cdl.roff1 = 1;
+	ref_cdl.rng = 1;
+	ref_cdl.rate = fx_sample_rate;
+	
+	/* delay walks and jumps, feedback up to full, range and rate change */
+	for(n=0;n<CHK_BLOCKS;n++)
+	{
+		len = chk_len();
+		p = (chk_rand() % 64) ? ADC_param[1] + (int32_t)(chk_rand() % 65) - 32 :
+			chk_rand() % 4096;
+		ADC_param[1] = p < 0 ? 0 : p > 4095 ? 4095 : p;
+		ADC_param[2] = chk_rand() % 4096;
+		if(!(chk_rand() % 200))
+			ADC_param[3] = chk_rand() % 4096;
+		if(n == CHK_BLOCKS/2)
+			fx_set_rate(44100);
+		for(i=0;i<2*len;i++)
+			src[i] = chk_s16();
+		
+		fx_cdr_struct.proc(blk, dst, src, len);
+		ref_cdl_proc(ref, src, len);
+		for(i=0;i<2*len;i++)
+			if(dst[i] != ref[i])
+			{
+				chk_miss("block %u frame %u %s got %d expected %d", n, i/2,
+					i&1 ? "R" : "L", dst[i], ref[i]);
+				break;
+			}
+	}
+	fx_set_rate(SAMPLE_RATE);
+	
+	return chk_done("ClnDly");
+}
+
+/*
+ * W/D mix, mute ramp and output metering in 64 bits
+ */
+static int chk_out(void)
+{
+	uint32_t n, pk;
+	int32_t wet, dry, cnt, dir, l, r;
+	uint16_t i, len, pl, pr;
+	int fails = 0;
+	
+	for(n=0;n<CHK_BLOCKS;n++)
+	{
+		len = chk_len();
+		wet = (chk_rand() & 3) ? chk_rand() % 0x1000 : (chk_rand() & 1) * 0xfff;
+		dry = 0xfff - wet;
+		for(i=0;i<2*len;i++)
+		{
+			chk_src[i] = chk_s32();
+			chk_dst[i] = chk_s32();
+		}
+		
+		/* fully wet or dry takes the single gain kernel, the same sum */
+		pl = pr = 0;
+		for(i=0;i<len;i++)
+		{
+			l = ((int64_t)chk_dst[2*i] * wet + (int64_t)chk_src[2*i] * dry) >> 12;
+			r = ((int64_t)chk_dst[2*i+1] * wet + (int64_t)chk_src[2*i+1] * dry) >> 12;
+			chk_ref[2*i] = l;
+			chk_ref[2*i+1] = r;
+			pl = ref_peak(pl, l >> 16);
+			pr = ref_peak(pr, r >> 16);
+		}
+		audio_out_pk = 0;
+		audio_out_pass(chk_dst, chk_src, len, wet, dry);
+		chk_block("pass", n, chk_dst, chk_ref, 2*len);
+		pk = pl | ((uint32_t)pr << 16);
+		if(audio_out_pk != pk)
+			chk_miss("pass block %u peak got 0x%08x expected 0x%08x", n,
+				audio_out_pk, pk);
+	}
+	fails += chk_done("audio_out_pass");
+	
+	for(n=0;n<CHK_BLOCKS;n++)
+	{
+		len = chk_len();
+		wet = chk_rand() % 0x1000;
+		dry = 0xfff - wet;
+		dir = (chk_rand() & 1) ? 1 : -1;
+		cnt = dir > 0 ? chk_rand() % (513 - len) : len + chk_rand() % (513 - len);
+		for(i=0;i<2*len;i++)
+		{
+			chk_src[i] = chk_s32();
+			chk_dst[i] = chk_s32();
+		}
+		
+		pl = pr = 0;
+		for(i=0;i<len;i++)
+		{
+			l = ((int64_t)chk_dst[2*i] * wet + (int64_t)chk_src[2*i] * dry) >> 12;
+			r = ((int64_t)chk_dst[2*i+1] * wet + (int64_t)chk_src[2*i+1] * dry) >> 12;
+			l = ((int64_t)l * (cnt + i*dir)) >> 9;
+			r = ((int64_t)r * (cnt + i*dir)) >> 9;
+			chk_ref[2*i] = l;
+			chk_ref[2*i+1] = r;
+			pl = ref_peak(pl, l >> 16);
+			pr = ref_peak(pr, r >> 16);
+		}
+		audio_out_pk = 0;
+		audio_out_ramp(chk_dst, chk_src, len, wet, dry, cnt, dir);
+		chk_block("ramp", n, chk_dst, chk_ref, 2*len);
+		pk = pl | ((uint32_t)pr << 16);
+		if(audio_out_pk != pk)
+			chk_miss("ramp block %u peak got 0x%08x expected 0x%08x", n,
+				audio_out_pk, pk);
+	}
+	fails += chk_done("audio_out_ramp");
+	
+	for(i=0;i<2*SMPS_MAX;i++)
+		chk_dst[i] = chk_s32() | 1;
+	memset(chk_ref, 0, sizeof(chk_ref));
+	audio_out_zero(chk_dst, SMPS_MAX);
+	chk_block("zero", 0, chk_dst, chk_ref, 2*SMPS_MAX);
+	fails += chk_done("audio_out_zero");
+	
+	return fails;
+}
+
+int main(void)
+{
+	int fails = 0;
+	
+	fx_set_rate(SAMPLE_RATE);
+	fails += chk_st();
+	fails += chk_32();
+	fails += chk_vca();
+	fails += chk_cdl();
+	fails += chk_out();
+	
+	return fails ? 1 : 0;
+}
@@ -0,0 +1,17 @@
+/*
+ * fx_bench.c - host run of the DSP kernel and effect benchmarks
+ * 10-17-26 E. Brombaugh
+ *
+ * usage: fx_bench > bench.csv
+ */
+
+#include "fx.h"
+#include "bench.h"
+
+int main(void)
+{
+	fx_init();
+	fx_set_rate(SAMPLE_RATE);
+	bench_run();
+	return 0;
+}
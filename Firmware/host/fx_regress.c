@@ -0,0 +1,381 @@
+/*
+ * fx_regress.c - bit-exact regression test of the effects against golden vectors
+ * 10-17-26 E. Brombaugh
+ *
+ * usage: fx_regress [-g] [-d dir] [id ...]
+ *   -g       write new golden vectors instead of checking, refusing any
+ *            silent one from an effect other than bypass
+ *   -d dir   golden vector directory (default golden)
+ *   id       registry ids of the effects to test (default all)
+ *
+ * Each effect starts from a fresh init and runs every stimulus with the same
+ * param trajectory, over REG_FRAMES and the full param ranges unless it has
+ * an entry in reg_profiles. Outputs are compared word for word against
+ * <dir>/<effect>_<stimulus>.bin, interleaved stereo int32 little-endian, so
+ * any change that isn't bit-exact fails with the first divergent sample and
+ * the largest error.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <math.h>
+#include <unistd.h>
+#include "fx.h"
+
+#define REG_FRAMES 4096			// frames per run unless the effect needs longer
+#define REG_MAX_FRAMES 32768
+#define REG_BLOCK 32
+#define REG_RATE 48000
+#define REG_FULL 0x7fffff00		// 24-bit full scale as the codec delivers it
+
+enum reg_stims
+{
+	REG_IMPULSE,
+	REG_SWEEP,
+	REG_NOISE,
+	REG_CLIP,
+	REG_NUM_STIMS
+};
+
+const char *reg_stim_names[REG_NUM_STIMS] =
+{
+	"impulse",
+	"sweep",
+	"noise",
+	"clip",
+};
+
+/*
+ * run length and param ranges for effects that need something other than
+ * the defaults - longer runs for feedback that takes a while to come round
+ * and delays held short enough that their taps stay inside the frames
+ * already written, so the vectors have echoes in them. Each param moves
+ * from its from to its to value along the shape reg_params() gives it.
+ */
+typedef struct
+{
+	const char *name;
+	uint32_t frames;
+	int16_t from[FX_MAX_PARAMS], to[FX_MAX_PARAMS];
+} reg_profile;
+
+const reg_profile reg_default = {NULL, REG_FRAMES, {0, 0, 0}, {4095, 4095, 4094}};
+
+const reg_profile reg_profiles[] =
+{
+	{"ClnDly", 16384, {0, 0, 0}, {800, 4095, 4094}},	// 2x to 8x DlyAmt frames
+	{"VCADly", 16384, {0, 0, 0}, {4095, 800, 4094}},	// 4x DlyAmt frames
+	{"LngDly", 16384, {0, 0, 0}, {400, 4095, 4094}},	// 8x or 16x DlyAmt frames
+	{"TapeDly", 16384, {2048, 0, 4094}, {0, 4095, 0}},	// shortening, fast Slew first
+	{"Reverb", 32768, {0, 0, 0}, {4095, 4095, 4094}},	// several trips round the tank
+};
+
+#define REG_NUM_PROFILES (sizeof(reg_profiles)/sizeof(reg_profile))
+
+static int32_t reg_in[2*REG_MAX_FRAMES], reg_out[2*REG_MAX_FRAMES], reg_gold[2*REG_MAX_FRAMES];
+static uint8_t reg_buf[4*2*REG_MAX_FRAMES];
+static const reg_profile *reg_prof;	// profile of the current run
+static uint32_t reg_frames;		// length of the current run
+
+/*
+ * integer sine so the stimuli don't depend on the host's libm - phase is a
+ * full turn in 32 bits, result is Q15
+ */
+static int32_t reg_sin(uint32_t phase)
+{
+	int32_t x = (int32_t)phase >> 16, y;
+	
+	/* parabola then one refinement step, within 0.1% */
+	y = (4 * x * (32768 - abs(x))) >> 15;
+	y += (7373 * (((y * abs(y)) >> 15) - y)) >> 15;
+	return y;
+}
+
+/*
+ * fill reg_in with a stimulus, trimmed to 24 bits
+ */
+static void reg_stimulus(uint8_t stim)
+{
+	uint32_t i, phs = 0, inc, rnd = 0x12345678;
+	int64_t smp;
+	
+	memset(reg_in, 0, 2*reg_frames*sizeof(int32_t));
+	for(i=0;i<reg_frames;i++)
+	{
+		switch(stim)
+		{
+			case REG_IMPULSE:
+				/* one at the start and one once the params have moved */
+				if(i == 0 || i == reg_frames/2)
+				{
+					reg_in[2*i] = REG_FULL;
+					reg_in[2*i+1] = -REG_FULL;
+				}
+				break;
+			
+			case REG_SWEEP:
+				/* linear chirp from DC to nyquist at -6dB, right a quarter turn ahead */
+				inc = (uint32_t)((uint64_t)i * 0x80000000u / reg_frames);
+				reg_in[2*i] = reg_sin(phs) * (REG_FULL>>16);
+				reg_in[2*i+1] = reg_sin(phs + 0x40000000) * (REG_FULL>>16);
+				phs += inc;
+				break;
+			
+			case REG_NOISE:
+				/* xorshift white noise at full scale */
+				rnd ^= rnd << 13;
+				rnd ^= rnd >> 17;
+				rnd ^= rnd << 5;
+				reg_in[2*i] = rnd;
+				rnd ^= rnd << 13;
+				rnd ^= rnd >> 17;
+				rnd ^= rnd << 5;
+				reg_in[2*i+1] = rnd;
+				break;
+			
+			case REG_CLIP:
+				/* 1kHz at 4x full scale, hard clipped */
+				smp = (int64_t)reg_sin(phs) * (REG_FULL>>14);
+				smp = smp > REG_FULL ? REG_FULL : smp;
+				smp = smp < -REG_FULL ? -REG_FULL : smp;
+				reg_in[2*i] = smp;
+				reg_in[2*i+1] = -smp;
+				phs += (uint32_t)(1000ull * 0x100000000ull / REG_RATE);
+				break;
+		}
+		reg_in[2*i] &= ~0xff;
+		reg_in[2*i+1] &= ~0xff;
+	}
+}
+
+/*
+ * params for a block - 1 ramps from to to, 2 is a triangle out to to and
+ * back and 3 steps through from, halfway and to
+ */
+static void reg_params(uint32_t frame)
+{
+	const int16_t *from = reg_prof->from, *to = reg_prof->to;
+	int32_t n = reg_frames, f = frame;
+	
+	ADC_param[1] = from[0] + (to[0] - from[0]) * f / n;
+	ADC_param[2] = from[1] + (to[1] - from[1]) * 2 * (f < n/2 ? f : n - f) / n;
+	ADC_param[3] = from[2] + (to[2] - from[2]) * (f * 3 / n) / 2;
+}
+
+/*
+ * run length and param ranges for an effect
+ */
+static const reg_profile *reg_profile_of(uint8_t algo)
+{
+	uint8_t i;
+	
+	for(i=0;i<REG_NUM_PROFILES;i++)
+		if(!strcmp(effects[algo]->name, reg_profiles[i].name))
+			return &reg_profiles[i];
+	
+	return &reg_default;
+}
+
+/*
+ * check an output has something in it
+ */
+static int reg_silent(void)
+{
+	uint32_t i;
+	
+	for(i=0;i<2*reg_frames;i++)
+		if(reg_out[i])
+			return 0;
+	
+	return 1;
+}
+
+/*
+ * run an effect from a fresh init over the stimulus in reg_in
+ */
+static void reg_run(uint8_t algo)
+{
+	uint32_t i;
+	
+	fx_select_algo(FX_ALGO_fx_bypass_struct);
+	fx_cache_flush();
+	reg_params(0);
+	fx_select_algo(algo);
+	
+	for(i=0;i<reg_frames;i+=REG_BLOCK)
+	{
+		reg_params(i);
+		fx_proc(&reg_out[2*i], &reg_in[2*i], REG_BLOCK);
+	}
+}
+
+/*
+ * golden vector file name
+ */
+static void reg_file(char *name, size_t len, const char *dir, uint8_t algo,
+	uint8_t stim)
+{
+	char *p;
+	
+	p = name + snprintf(name, len, "%s/", dir);
+	snprintf(p, len - (p - name), "%s_%s.bin", effects[algo]->name,
+		reg_stim_names[stim]);
+	for(;*p;p++)
+		*p = tolower(*p);
+}
+
+static int reg_save(const char *name)
+{
+	uint8_t *buf = reg_buf;
+	FILE *f;
+	uint32_t i;
+	int ret;
+	
+	for(i=0;i<2*reg_frames;i++)
+	{
+		buf[4*i] = reg_out[i];
+		buf[4*i+1] = reg_out[i]>>8;
+		buf[4*i+2] = reg_out[i]>>16;
+		buf[4*i+3] = reg_out[i]>>24;
+	}
+	if(!(f = fopen(name, "wb")))
+		return 1;
+	ret = fwrite(buf, 1, 4*2*reg_frames, f) != 4*2*reg_frames;
+	fclose(f);
+	return ret;
+}
+
+static int reg_load(const char *name)
+{
+	uint8_t *buf = reg_buf;
+	FILE *f;
+	uint32_t i;
+	int ret;
+	
+	if(!(f = fopen(name, "rb")))
+		return 1;
+	ret = (fread(buf, 1, 4*2*reg_frames, f) != 4*2*reg_frames) || (fgetc(f) != EOF);
+	fclose(f);
+	for(i=0;i<2*reg_frames;i++)
+		reg_gold[i] = buf[4*i] | (buf[4*i+1]<<8) | (buf[4*i+2]<<16) |
+			((uint32_t)buf[4*i+3]<<24);
+	return ret;
+}
+
+/*
+ * compare reg_out with reg_gold, returns 0 if bit-exact
+ */
+static int reg_compare(uint8_t algo, uint8_t stim)
+{
+	uint32_t i, first = 2*reg_frames, diffs = 0;
+	int64_t err, max_err = 0;
+	
+	for(i=0;i<2*reg_frames;i++)
+	{
+		if(reg_out[i] == reg_gold[i])
+			continue;
+		if(!diffs++)
+			first = i;
+		err = llabs((int64_t)reg_out[i] - reg_gold[i]);
+		max_err = err > max_err ? err : max_err;
+	}
+	
+	if(!diffs)
+	{
+		printf("PASS %-8s %s\n", effects[algo]->name, reg_stim_names[stim]);
+		return 0;
+	}
+	
+	printf("FAIL %-8s %s: %u samples differ, first at frame %u %s got 0x%08x expected"
+		" 0x%08x, max error %lld (%.1f dBFS)\n", effects[algo]->name,
+		reg_stim_names[stim], diffs, first/2, first&1 ? "R" : "L",
+		reg_out[first], reg_gold[first], (long long)max_err,
+		20*log10((double)max_err / 0x80000000u));
+	return 1;
+}
+
+int main(int argc, char **argv)
+{
+	char name[512];
+	const char *dir = "golden";
+	uint8_t algo, stim, gen = 0, sel[FX_NUM_ALGOS];
+	int c, i, fails = 0;
+	
+	while((c = getopt(argc, argv, "gd:")) != -1)
+	{
+		switch(c)
+		{
+			case 'g':
+				gen = 1;
+				break;
+			
+			case 'd':
+				dir = optarg;
+				break;
+			
+			default:
+				fprintf(stderr, "usage: fx_regress [-g] [-d dir] [id ...]\n");
+				return 1;
+		}
+	}
+	
+	/* pick effects by registry id so tests keep their names across variants */
+	memset(sel, optind == argc, sizeof(sel));
+	for(i=optind;i<argc;i++)
+	{
+		algo = fx_find_id(atoi(argv[i]));
+		if(fx_ids[algo] != atoi(argv[i]))
+		{
+			fprintf(stderr, "no effect with id %s\n", argv[i]);
+			return 1;
+		}
+		sel[algo] = 1;
+	}
+	
+	fx_init();
+	fx_set_rate(REG_RATE);
+	fx_set_xfade(0);
+	
+	for(algo=0;algo<FX_NUM_ALGOS;algo++)
+	{
+		if(!sel[algo])
+			continue;
+		
+		reg_prof = reg_profile_of(algo);
+		reg_frames = reg_prof->frames;
+		for(stim=0;stim<REG_NUM_STIMS;stim++)
+		{
+			reg_stimulus(stim);
+			reg_run(algo);
+			reg_file(name, sizeof(name), dir, algo, stim);
+			if(gen)
+			{
+				/* a silent vector can't catch anything - fix the profile */
+				if((algo != FX_ALGO_fx_bypass_struct) && reg_silent())
+				{
+					fprintf(stderr, "%s %s is silent, not writing %s\n",
+						effects[algo]->name, reg_stim_names[stim], name);
+					return 1;
+				}
+				if(reg_save(name))
+				{
+					fprintf(stderr, "can't write %s\n", name);
+					return 1;
+				}
+				printf("wrote %s\n", name);
+			}
+			else if(reg_load(name))
+			{
+				printf("FAIL %-8s %s: no golden vector %s\n", effects[algo]->name,
+					reg_stim_names[stim], name);
+				fails++;
+			}
+			else
+				fails += reg_compare(algo, stim);
+		}
+	}
+	
+	return fails ? 1 : 0;
+}
@@ -0,0 +1,293 @@
+/*
+ * fx_render.c - offline renderer, runs WAV files through the effects on a host
+ * 10-17-26 E. Brombaugh
+ *
+ * usage: fx_render [options] in.wav out.wav
+ *   -e name|n   effect to run (default Bypass)
+ *   -p n=val    set param n (1-3, or w for W/D) to val (0-4095)
+ *   -s file     param automation script
+ *   -b frames   block size (default 32)
+ *   -t secs     silence appended for tails (default 0)
+ *   -l          list the effects
+ *
+ * A script has one breakpoint per line - time in seconds, param (1-3 or w)
+ * and value - and each param ramps linearly between its breakpoints. Times
+ * for a param must not go backwards. Lines starting with # are ignored.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
+#include "fx.h"
+#include "wav.h"
+
+#define RENDER_MAX_FRAMES 128	// same as the firmware's biggest block
+#define RENDER_MAX_POINTS 1024
+#define RENDER_WET 0			// slot for W/D, effect params are 1-3
+#define RENDER_NUM_PARMS (FX_MAX_PARAMS+1)
+
+typedef struct
+{
+	double time;
+	uint8_t parm;
+	int16_t val;
+} render_point;
+
+static render_point render_pts[RENDER_MAX_POINTS];
+static uint32_t render_num_pts;
+static int16_t render_val[RENDER_NUM_PARMS];
+
+/*
+ * param slot from its name
+ */
+static int render_parm_idx(const char *name)
+{
+	if(!strcasecmp(name, "w"))
+		return RENDER_WET;
+	if(name[0] >= '1' && name[0] <= '0'+FX_MAX_PARAMS && !name[1])
+		return name[0]-'0';
+	return -1;
+}
+
+/*
+ * load the automation script, returns 0 if OK
+ */
+static int render_load_script(const char *name)
+{
+	FILE *f;
+	char line[256], parm[8];
+	double time, last[RENDER_NUM_PARMS];
+	int val, idx, n = 0;
+	
+	if(!(f = fopen(name, "r")))
+	{
+		fprintf(stderr, "can't open script %s\n", name);
+		return 1;
+	}
+	
+	for(idx=0;idx<RENDER_NUM_PARMS;idx++)
+		last[idx] = 0;
+	while(fgets(line, sizeof(line), f))
+	{
+		n++;
+		if(line[strspn(line, " \t\r\n")] == '#' || line[strspn(line, " \t\r\n")] == 0)
+			continue;
+		if(sscanf(line, "%lf %7s %d", &time, parm, &val) != 3 ||
+			(idx = render_parm_idx(parm)) < 0 || val < 0 || val > 4095 ||
+			time < last[idx])
+		{
+			fprintf(stderr, "%s:%d: bad breakpoint\n", name, n);
+			fclose(f);
+			return 1;
+		}
+		if(render_num_pts == RENDER_MAX_POINTS)
+		{
+			fprintf(stderr, "%s: more than %d breakpoints\n", name, RENDER_MAX_POINTS);
+			fclose(f);
+			return 1;
+		}
+		render_pts[render_num_pts].time = time;
+		render_pts[render_num_pts].parm = idx;
+		render_pts[render_num_pts].val = val;
+		render_num_pts++;
+		last[idx] = time;
+	}
+	fclose(f);
+	return 0;
+}
+
+/*
+ * param values at a time - ramps between the breakpoints on either side,
+ * holding the first before it and the last after it
+ */
+static void render_automate(double time)
+{
+	render_point *prev[RENDER_NUM_PARMS] = {NULL}, *next[RENDER_NUM_PARMS] = {NULL};
+	render_point *p;
+	uint32_t i;
+	uint8_t idx;
+	
+	for(i=0;i<render_num_pts;i++)
+	{
+		p = &render_pts[i];
+		if(p->time <= time)
+			prev[p->parm] = p;
+		else if(!next[p->parm])
+			next[p->parm] = p;
+	}
+	
+	for(idx=0;idx<RENDER_NUM_PARMS;idx++)
+	{
+		if(prev[idx] && next[idx])
+			render_val[idx] = prev[idx]->val + (next[idx]->val - prev[idx]->val) *
+				(time - prev[idx]->time) / (next[idx]->time - prev[idx]->time);
+		else if(prev[idx])
+			render_val[idx] = prev[idx]->val;
+		else if(next[idx])
+			render_val[idx] = next[idx]->val;
+	}
+}
+
+/*
+ * effect from a name or index, FX_NUM_ALGOS if none
+ */
+static uint8_t render_find_algo(const char *name)
+{
+	char *end;
+	long n;
+	uint8_t i;
+	
+	n = strtol(name, &end, 0);
+	if(!*end)
+		return n >= 0 && n < FX_NUM_ALGOS ? n : FX_NUM_ALGOS;
+	
+	for(i=0;i<FX_NUM_ALGOS;i++)
+		if(!strcasecmp(name, effects[i]->name))
+			break;
+	return i;
+}
+
+static void render_usage(void)
+{
+	fprintf(stderr, "usage: fx_render [-e effect] [-p n=val] [-s script] [-b frames]"
+		" [-t secs] [-l] in.wav out.wav\n");
+}
+
+int main(int argc, char **argv)
+{
+	static int32_t src[2*RENDER_MAX_FRAMES], dst[2*RENDER_MAX_FRAMES];
+	wav_buf in;
+	int32_t *out;
+	uint32_t frames, len, i, j;
+	uint16_t sz = FRAMESZ;
+	uint8_t algo = FX_ALGO_fx_bypass_struct;
+	double tail = 0, secs;
+	struct timespec t0, t1;
+	char *eq;
+	int c, idx;
+	
+	/* chain sizes are only known after this */
+	fx_init();
+	
+	render_val[RENDER_WET] = 0xfff;
+	for(idx=1;idx<RENDER_NUM_PARMS;idx++)
+		render_val[idx] = 0x800;
+	
+	while((c = getopt(argc, argv, "e:p:s:b:t:l")) != -1)
+	{
+		switch(c)
+		{
+			case 'e':
+				if((algo = render_find_algo(optarg)) == FX_NUM_ALGOS)
+				{
+					fprintf(stderr, "unknown effect %s - try -l\n", optarg);
+					return 1;
+				}
+				break;
+			
+			case 'p':
+				if(!(eq = strchr(optarg, '=')))
+				{
+					render_usage();
+					return 1;
+				}
+				*eq = 0;
+				if((idx = render_parm_idx(optarg)) < 0)
+				{
+					fprintf(stderr, "unknown param %s\n", optarg);
+					return 1;
+				}
+				render_val[idx] = atoi(eq+1) & 0xfff;
+				break;
+			
+			case 's':
+				if(render_load_script(optarg))
+					return 1;
+				break;
+			
+			case 'b':
+				sz = atoi(optarg);
+				if(sz < 1 || sz > RENDER_MAX_FRAMES)
+				{
+					fprintf(stderr, "block size must be 1 to %d\n", RENDER_MAX_FRAMES);
+					return 1;
+				}
+				break;
+			
+			case 't':
+				tail = atof(optarg);
+				break;
+			
+			case 'l':
+				for(i=0;i<FX_NUM_ALGOS;i++)
+					printf("%2d %-8s %6d bytes\n", i, effects[i]->name,
+						effects[i]->mem_size);
+				return 0;
+			
+			default:
+				render_usage();
+				return 1;
+		}
+	}
+	if(argc - optind != 2)
+	{
+		render_usage();
+		return 1;
+	}
+	
+	if(wav_read(argv[optind], &in))
+		return 1;
+	frames = in.frames + (uint32_t)(tail * in.rate);
+	if(!(out = malloc(frames * 2 * sizeof(int32_t))))
+	{
+		fprintf(stderr, "out of memory\n");
+		return 1;
+	}
+	
+	/* start straight into the effect with no fade in */
+	fx_set_rate(in.rate);
+	fx_set_xfade(0);
+	for(idx=1;idx<RENDER_NUM_PARMS;idx++)
+		ADC_param[idx] = render_val[idx];
+	fx_select_algo(algo);
+	printf("%s: %d frames at %d Hz through %s, %d frame blocks\n", argv[optind],
+		in.frames, in.rate, effects[algo]->name, sz);
+	
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	for(i=0;i<frames;i+=len)
+	{
+		len = frames - i < sz ? frames - i : sz;
+		
+		/* params change once a block, like the pots */
+		if(render_num_pts)
+			render_automate((double)i / in.rate);
+		for(idx=1;idx<RENDER_NUM_PARMS;idx++)
+			ADC_param[idx] = render_val[idx];
+		
+		for(j=0;j<len;j++)
+		{
+			src[2*j] = i+j < in.frames ? in.data[2*(i+j)] : 0;
+			src[2*j+1] = i+j < in.frames ? in.data[2*(i+j)+1] : 0;
+		}
+		
+		fx_proc(dst, src, len);
+		
+		/* same W/D mix as the output kernel */
+		for(j=0;j<2*len;j++)
+			out[2*i+j] = dsp_mix32(dst[j], render_val[RENDER_WET], src[j],
+				0xfff - render_val[RENDER_WET], 12);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	
+	secs = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) * 1e-9;
+	printf("%d frames in %.3f s: %.0f frames/s, %.1fx real time\n", frames, secs,
+		frames / secs, frames / secs / in.rate);
+	
+	c = wav_write(argv[optind+1], out, frames, in.rate);
+	free(out);
+	wav_free(&in);
+	return c;
+}
@@ -0,0 +1,29 @@
+/*
+ * clocks.h - host stand-in for the pico SDK clocks API
+ * 10-17-26 E. Brombaugh
+ */
+
+#ifndef __host_clocks__
+#define __host_clocks__
+
+#include "pico/stdlib.h"
+
+enum clock_index
+{
+	clk_gpout0 = 0,
+	clk_gpout1,
+	clk_gpout2,
+	clk_gpout3,
+	clk_ref,
+	clk_sys,
+	clk_peri,
+	clk_usb,
+	clk_adc,
+	clk_rtc,
+};
+
+#define MHZ 1000000
+
+uint32_t clock_get_hz(enum clock_index clk_index);
+
+#endif
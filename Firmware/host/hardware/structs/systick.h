@@ -0,0 +1,24 @@
+/*
+ * systick.h - host stand-in for the M0+ SysTick registers
+ * 10-17-26 E. Brombaugh
+ */
+
+#ifndef __host_systick__
+#define __host_systick__
+
+#include <stdint.h>
+
+typedef struct
+{
+	volatile uint32_t csr;
+	volatile uint32_t rvr;
+	volatile uint32_t cvr;	// never counts on the host so cycle stats read 0
+	volatile uint32_t calib;
+} systick_hw_t;
+
+#define M0PLUS_SYST_CSR_ENABLE_BITS 0x00000001
+#define M0PLUS_SYST_CSR_CLKSOURCE_BITS 0x00000004
+
+extern systick_hw_t *systick_hw;
+
+#endif
@@ -0,0 +1,65 @@
+/*
+ * host_shim.c - stand-ins for the firmware side of the effects on the host
+ * 10-17-26 E. Brombaugh
+ */
+
+#include "fx.h"
+#include "audio.h"
+#include "hardware/clocks.h"
+#include "hardware/structs/systick.h"
+
+/* clk_sys the firmware would run at, for the chain cycle budget */
+#define HOST_SYS_HZ 125000000
+
+/* params the effects read - no pots, the renderer sets them */
+volatile int16_t ADC_val[ADC_NUMVALS], ADC_param[ADC_NUMPARAMS];
+
+static systick_hw_t host_systick;
+systick_hw_t *systick_hw = &host_systick;
+
+static uint32_t host_seq;
+
+void ADC_setparamval(uint8_t idx, int16_t val)
+{
+	ADC_param[idx] = val;
+}
+
+uint32_t clock_get_hz(enum clock_index clk_index)
+{
+	return HOST_SYS_HZ;
+}
+
+/*
+ * no audio core on the host - commands run as they're posted, so
+ * everything is done as soon as it's asked for
+ */
+uint8_t Audio_Cmd_Done(uint32_t seq)
+{
+	return 1;
+}
+
+uint32_t Audio_Set_Algo(uint8_t algo, void *blk, uint8_t xfade)
+{
+	fx_switch(algo, blk, xfade);
+	return ++host_seq;
+}
+
+uint32_t Audio_Set_Mute(uint8_t enable)
+{
+	return ++host_seq;
+}
+
+void Audio_Wait_Mute(uint32_t seq)
+{
+}
+
+uint32_t Audio_Set_Param(uint8_t idx, int16_t val)
+{
+	ADC_setparamval(idx, val);
+	return ++host_seq;
+}
+
+/* no LCD */
+void gfx_drawstrrect(GFX_RECT *rect, char *str)
+{
+}
@@ -0,0 +1,27 @@
+/*
+ * stdlib.h - host stand-in for the bits of the pico SDK the DSP code uses
+ * 10-17-26 E. Brombaugh
+ */
+
+#ifndef __host_stdlib__
+#define __host_stdlib__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#define PICO_ON_DEVICE 0
+
+/* no flash or scratch banks on the host */
+#define __not_in_flash_func(f) f
+#define __not_in_flash(g)
+#define __scratch_x(g)
+#define __scratch_y(g)
+#define __time_critical_func(f) f
+
+typedef unsigned int uint;
+
+static inline void __dmb(void) {}
+static inline void tight_loop_contents(void) {}
+
+#endif
@@ -0,0 +1,193 @@
+/*
+ * wav.c - minimal WAV file read/write for the host tools
+ * 10-17-26 E. Brombaugh
+ *
+ * Reads 16, 24 and 32-bit PCM mono or stereo and writes 24-bit stereo, the
+ * codec's width.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "wav.h"
+
+#define WAV_FMT_PCM 1
+#define WAV_FMT_EXT 0xfffe
+
+static uint32_t wav_get16(const uint8_t *p)
+{
+	return p[0] | (p[1]<<8);
+}
+
+static uint32_t wav_get32(const uint8_t *p)
+{
+	return p[0] | (p[1]<<8) | (p[2]<<16) | ((uint32_t)p[3]<<24);
+}
+
+static void wav_put16(uint8_t *p, uint32_t val)
+{
+	p[0] = val;
+	p[1] = val>>8;
+}
+
+static void wav_put32(uint8_t *p, uint32_t val)
+{
+	wav_put16(p, val);
+	wav_put16(p+2, val>>16);
+}
+
+/*
+ * read a whole file into Q31 stereo, returns 0 if OK
+ */
+int wav_read(const char *name, wav_buf *wav)
+{
+	FILE *f;
+	uint8_t hdr[40], *raw = NULL;
+	uint32_t len, fmt = 0, bytes, i, j, bps;
+	int32_t smp;
+	
+	memset(wav, 0, sizeof(wav_buf));
+	if(!(f = fopen(name, "rb")))
+	{
+		fprintf(stderr, "wav_read: can't open %s\n", name);
+		return 1;
+	}
+	
+	if(fread(hdr, 1, 12, f) != 12 || memcmp(hdr, "RIFF", 4) ||
+		memcmp(hdr+8, "WAVE", 4))
+	{
+		fprintf(stderr, "wav_read: %s isn't a WAV file\n", name);
+		goto err;
+	}
+	
+	/* walk the chunks for fmt and data */
+	while(fread(hdr, 1, 8, f) == 8)
+	{
+		len = wav_get32(hdr+4);
+		if(!memcmp(hdr, "fmt ", 4))
+		{
+			if(len < 16 || len > sizeof(hdr) || fread(hdr, 1, len, f) != len)
+				goto bad;
+			fmt = wav_get16(hdr);
+			wav->chans = wav_get16(hdr+2);
+			wav->rate = wav_get32(hdr+4);
+			wav->bits = wav_get16(hdr+14);
+			if(fmt == WAV_FMT_EXT && len >= 26)
+				fmt = wav_get16(hdr+24);
+		}
+		else if(!memcmp(hdr, "data", 4))
+		{
+			if(fmt != WAV_FMT_PCM || wav->chans < 1 || wav->chans > 2 ||
+				(wav->bits != 16 && wav->bits != 24 && wav->bits != 32))
+			{
+				fprintf(stderr, "wav_read: %s must be 16/24/32-bit PCM mono or stereo\n",
+					name);
+				goto err;
+			}
+			bps = wav->bits/8;
+			wav->frames = len / (bps*wav->chans);
+			bytes = wav->frames * bps * wav->chans;
+			raw = malloc(bytes);
+			wav->data = malloc(wav->frames * 2 * sizeof(int32_t));
+			if(!raw || !wav->data)
+			{
+				fprintf(stderr, "wav_read: out of memory\n");
+				goto err;
+			}
+			if(fread(raw, 1, bytes, f) != bytes)
+				goto bad;
+			
+			/* left justify to Q31, mono to both channels */
+			for(i=0;i<wav->frames;i++)
+			{
+				for(j=0;j<wav->chans;j++)
+				{
+					const uint8_t *p = raw + (i*wav->chans + j)*bps;
+					if(bps == 2)
+						smp = wav_get16(p)<<16;
+					else if(bps == 3)
+						smp = (p[0]<<8) | (p[1]<<16) | ((uint32_t)p[2]<<24);
+					else
+						smp = wav_get32(p);
+					wav->data[2*i+j] = smp;
+				}
+				if(wav->chans == 1)
+					wav->data[2*i+1] = wav->data[2*i];
+			}
+			free(raw);
+			fclose(f);
+			return 0;
+		}
+		else
+			fseek(f, len + (len&1), SEEK_CUR);
+	}
+	
+bad:
+	fprintf(stderr, "wav_read: %s is truncated or has no audio\n", name);
+err:
+	free(raw);
+	wav_free(wav);
+	fclose(f);
+	return 1;
+}
+
+/*
+ * write Q31 stereo as 24-bit, returns 0 if OK
+ */
+int wav_write(const char *name, const int32_t *data, uint32_t frames,
+	uint32_t rate)
+{
+	FILE *f;
+	uint8_t hdr[44], *raw;
+	uint32_t i, bytes = frames*2*3;
+	int ret = 0;
+	
+	if(!(f = fopen(name, "wb")))
+	{
+		fprintf(stderr, "wav_write: can't create %s\n", name);
+		return 1;
+	}
+	
+	memcpy(hdr, "RIFF", 4);
+	wav_put32(hdr+4, 36 + bytes);
+	memcpy(hdr+8, "WAVEfmt ", 8);
+	wav_put32(hdr+16, 16);
+	wav_put16(hdr+20, WAV_FMT_PCM);
+	wav_put16(hdr+22, 2);
+	wav_put32(hdr+24, rate);
+	wav_put32(hdr+28, rate*2*3);
+	wav_put16(hdr+32, 2*3);
+	wav_put16(hdr+34, 24);
+	memcpy(hdr+36, "data", 4);
+	wav_put32(hdr+40, bytes);
+	
+	/* top 24 bits, same as the codec takes */
+	if(!(raw = malloc(bytes)))
+	{
+		fprintf(stderr, "wav_write: out of memory\n");
+		fclose(f);
+		return 1;
+	}
+	for(i=0;i<frames*2;i++)
+	{
+		raw[3*i] = data[i]>>8;
+		raw[3*i+1] = data[i]>>16;
+		raw[3*i+2] = data[i]>>24;
+	}
+	
+	if(fwrite(hdr, 1, 44, f) != 44 || fwrite(raw, 1, bytes, f) != bytes)
+	{
+		fprintf(stderr, "wav_write: error writing %s\n", name);
+		ret = 1;
+	}
+	free(raw);
+	fclose(f);
+	return ret;
+}
+
+void wav_free(wav_buf *wav)
+{
+	free(wav->data);
+	wav->data = NULL;
+	wav->frames = 0;
+}
@@ -0,0 +1,29 @@
+/*
+ * wav.h - minimal WAV file read/write for the host tools
+ * 10-17-26 E. Brombaugh
+ */
+
+#ifndef __wav__
+#define __wav__
+
+#include <stdint.h>
+
+/*
+ * audio held the way the firmware sees it - interleaved stereo Q31 with mono
+ * files duplicated to both channels
+ */
+typedef struct
+{
+	uint32_t rate;
+	uint16_t chans;		// in the file
+	uint16_t bits;		// in the file
+	uint32_t frames;
+	int32_t *data;
+} wav_buf;
+
+int wav_read(const char *name, wav_buf *wav);
+int wav_write(const char *name, const int32_t *data, uint32_t frames,
+	uint32_t rate);
+void wav_free(wav_buf *wav);
+
+#endif
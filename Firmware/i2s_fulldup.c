@@ -18,13 +18,14 @@
 #include "pico/multicore.h"
 #include "i2s_fulldup.pio.h"
 #include "audio.h"
+#include "fx.h"
+#include "wm8731.h"
+#include "prof.h"
+#include "clkplan.h"
 
 /* uncomment this to run audio processing on core 1 */
 #define MULTICORE
 
-/* I2S PIO has L+R (Frames) in 32-bits */
-#define FRAMES_PER_BUFFER (BUFSZ/2)
-
 /* I2S comes out on these pins */
 #if 0
 /* HW V0.1 */
@@ -46,18 +47,349 @@
 #define OUT_DIAG_PIN 11		// TP6
 #endif
 
+/* comment this out to re-arm the DMA from the IRQs on every block */
+#define CHAINED_DMA
+
 /* resources we use */
 PIO pio;
-uint sm;
+uint sm, pio_offset;
+
+/*
+ * I2S PIO runs 32-bit slots so each frame is two FIFO words, L then R, with
+ * 24-bit samples left justified. The block size can be changed at runtime
+ * so both double buffers are carved from one pool sized for the largest
+ * block. Each half is aligned to its own size as needed by the DMA ring wrap.
+ */
+#define I2S_SLOT_BITS 32
+#define I2S_FW (I2S_SLOT_BITS/16)	// FIFO words per frame
+uint16_t i2s_frames;
+uint32_t i2s_rate;				// nominal sample rate
+uint32_t i2s_pool[2*2*I2S_FW*SMPS_MAX] __attribute__((aligned(2*I2S_FW*SMPS_MAX*sizeof(uint32_t))));
+uint32_t *input_buf, *output_buf;
+
+/*
+ * Xrun detection:
+ * The audio core counts xruns by cause and logs the most recent ones with
+ * a timestamp and block number. Only the audio core writes the log and it
+ * brackets updates with a sequence count so core 0 can take a consistent
+ * copy for display without blocking it.
+ */
+const char *i2s_xrun_names[XRUN_NUM_CAUSES] =
+{
+	"Ovrrun",
+	"Late",
+	"TxStal",
+	"RxStal",
+};
+volatile uint32_t i2s_xrun_cnt[XRUN_NUM_CAUSES];
+i2s_xrun_entry i2s_xrun_log[XRUN_LOG_LEN];
+volatile uint32_t i2s_xrun_seq;
+uint32_t i2s_xrun_total;
+static volatile uint8_t i2s_xrun_clr_req;
+
+/*
+ * add an entry to the xrun log - only from the audio core
+ */
+static void __not_in_flash_func(i2s_xrun_add)(uint8_t cause, uint32_t block, uint16_t count)
+{
+	i2s_xrun_entry *entry = &i2s_xrun_log[i2s_xrun_total & (XRUN_LOG_LEN-1)];
+	
+	i2s_xrun_seq++;
+	__dmb();
+	entry->time = time_us_32();
+	entry->block = block;
+	entry->cause = cause;
+	entry->count = count;
+	i2s_xrun_cnt[cause]++;
+	i2s_xrun_total++;
+	__dmb();
+	i2s_xrun_seq++;
+}
+
+/*
+ * handle clear requests and check the PIO for FIFO stalls which mean the
+ * DMA couldn't keep up - only from the audio core
+ */
+static void __not_in_flash_func(i2s_xrun_check)(uint32_t block)
+{
+	uint32_t stall, txstall = 1u << (PIO_FDEBUG_TXSTALL_LSB + sm),
+		rxstall = 1u << (PIO_FDEBUG_RXSTALL_LSB + sm);
+	
+	if(i2s_xrun_clr_req)
+	{
+		i2s_xrun_seq++;
+		__dmb();
+		memset((void *)i2s_xrun_cnt, 0, sizeof(i2s_xrun_cnt));
+		i2s_xrun_total = 0;
+		__dmb();
+		i2s_xrun_seq++;
+		i2s_xrun_clr_req = 0;
+	}
+	
+	stall = pio->fdebug & (txstall | rxstall);
+	if(stall)
+	{
+		pio->fdebug = stall;
+		if(stall & txstall)
+			i2s_xrun_add(XRUN_TXSTALL, block, 1);
+		if(stall & rxstall)
+			i2s_xrun_add(XRUN_RXSTALL, block, 1);
+	}
+}
+
+#ifdef CHAINED_DMA
+/*
+ * Chained transport:
+ * Each direction uses a pair of DMA channels, one per buffer half, which
+ * are chained to each other and ring-wrap on their half so the hardware
+ * ping-pongs forever without being touched. Input and output are started
+ * together so they stay in phase and the input half that just completed
+ * is always rendered into the same output half, which the output DMA
+ * won't reach until one full block period later. The IRQ only acks and
+ * posts the index of the ready half - rendering is done by whoever calls
+ * i2s_fulldup_service(), so IRQ latency can't cause an underrun.
+ */
+uint dma_chan_input[2], dma_chan_output[2];
+volatile uint32_t i2s_ready_seq;
+volatile uint8_t i2s_ready_idx;
+static uint32_t i2s_done_seq;		// only written by the rendering core
+static uint32_t i2s_start_seq;		// ready_seq when the transport last started
+static uint8_t i2s_held;			// audio core parked by i2s_fulldup_hold()
+
+/*
+ * Low latency mode:
+ * Normally a block captured in input half N is played from output half N
+ * a full block later, so the round trip is 2 blocks. In low latency mode a
+ * third channel shifts out a short run of silence before chaining into the
+ * output pair. The output is then locked to the input completion by that
+ * fixed phase and each block goes to the other output half, which starts
+ * playing only "phase" frames after the block was captured. The processing
+ * deadline shrinks to the phase less the depth of the TX FIFO.
+ */
+#define I2S_TX_LEAD 5		// TX FIFO + OSR words fetched ahead of the pins
+uint dma_chan_preroll;
+uint8_t i2s_lowlat;			// output phase in 1/4 blocks, 0 = off
+uint16_t i2s_phase;			// output phase in frames, 0 = off
+uint8_t i2s_out_xor;		// output half relative to input half
+static uint32_t i2s_zero;
+
+/*
+ * IRQ0 handler - posts completed I2S input halves
+ */
+void dma_input_handler(void)
+{
+	uint32_t ints = dma_hw->ints0;
+	uint8_t i;
+	
+	gpio_put(OUT_DIAG_PIN, 1);
+	
+	for(i=0;i<2;i++)
+	{
+		if(ints & (1u << dma_chan_input[i]))
+		{
+			/* Clear IRQ and post half as ready */
+			dma_hw->ints0 = 1u << dma_chan_input[i];
+			i2s_ready_idx = i;
+			i2s_ready_seq++;
+		}
+	}
+	
+	gpio_put(OUT_DIAG_PIN, 0);
+	
+#ifndef MULTICORE
+	/* no spare core to hand the block to so render it here */
+	i2s_fulldup_service();
+#endif
+}
+
+/*
+ * render the most recently completed block if it hasn't been done yet
+ */
+void __not_in_flash_func(i2s_fulldup_service)(void)
+{
+	uint8_t idx;
+	uint32_t seq, remain;
+	dma_channel_hw_t *out;
+	
+	if(i2s_done_seq == i2s_ready_seq)
+		return;
+	
+	/* grab the latest ready half */
+	do
+	{
+		seq = i2s_ready_seq;
+		idx = i2s_ready_idx;
+	}
+	while(seq != i2s_ready_seq);
+	
+	/* any blocks skipped were never rendered so their output replays stale data */
+	if(seq - i2s_done_seq > 1)
+		i2s_xrun_add(XRUN_OVERRUN, seq, seq - i2s_done_seq - 1);
+	i2s_done_seq = seq;
+	
+	gpio_put(IN_DIAG_PIN, 1);
+	Audio_Proc((int32_t *)&output_buf[(idx^i2s_out_xor)*I2S_FW*i2s_frames],
+		(int32_t *)&input_buf[idx*I2S_FW*i2s_frames],
+		2*i2s_frames);
+	gpio_put(IN_DIAG_PIN, 0);
+	
+	/* late if the output DMA had already started reading the half we wrote */
+	out = dma_channel_hw_addr(dma_chan_output[idx^i2s_out_xor]);
+	if(out->ctrl_trig & DMA_CH0_CTRL_TRIG_BUSY_BITS)
+	{
+		remain = out->transfer_count/I2S_FW;
+		if(remain < i2s_frames)
+			i2s_xrun_add(XRUN_LATE, seq, i2s_frames - remain);
+	}
+	
+	i2s_xrun_check(seq);
+}
+
+/*
+ * check if there's no block waiting to be rendered
+ */
+static uint8_t i2s_fulldup_idle(void)
+{
+	return i2s_done_seq == i2s_ready_seq;
+}
+
+/*
+ * configure ring-wrapped dma channel pairs, each chained to its mate,
+ * and start them
+ */
+static void i2s_fulldup_dma_start(void)
+{
+	uint8_t i, ring_bits = __builtin_ctz(I2S_FW*i2s_frames*sizeof(uint32_t));
+	
+	for(i=0;i<2;i++)
+	{
+		dma_channel_config c = dma_channel_get_default_config(dma_chan_input[i]);
+		channel_config_set_read_increment(&c,false);
+		channel_config_set_write_increment(&c,true);
+		channel_config_set_ring(&c, true, ring_bits);
+		channel_config_set_chain_to(&c, dma_chan_input[i^1]);
+		channel_config_set_dreq(&c,pio_get_dreq(pio,sm,false));
+		channel_config_set_transfer_data_size(&c, DMA_SIZE_32);
+		dma_channel_configure(
+			dma_chan_input[i],
+			&c,
+			&input_buf[i*I2S_FW*i2s_frames],	// Destination pointer
+			&pio->rxf[sm], 				// Source pointer
+			I2S_FW*i2s_frames,			// Number of transfers
+			false						// Started below
+		);
+		dma_channel_set_irq0_enabled(dma_chan_input[i], true);
+		
+		dma_channel_config cc = dma_channel_get_default_config(dma_chan_output[i]);
+		channel_config_set_read_increment(&cc,true);
+		channel_config_set_write_increment(&cc,false);
+		channel_config_set_ring(&cc, false, ring_bits);
+		channel_config_set_chain_to(&cc, dma_chan_output[i^1]);
+		channel_config_set_dreq(&cc,pio_get_dreq(pio,sm,true));
+		channel_config_set_transfer_data_size(&cc, DMA_SIZE_32);
+		dma_channel_configure(
+			dma_chan_output[i],
+			&cc,
+			&pio->txf[sm],				// Destination pointer
+			&output_buf[i*I2S_FW*i2s_frames],	// Source pointer
+			I2S_FW*i2s_frames,			// Number of transfers
+			false						// Started below
+		);
+	}
+	
+	/* work out output phase for low latency mode */
+	i2s_phase = (i2s_lowlat*i2s_frames)/4;
+	if(i2s_phase)
+	{
+		i2s_phase = i2s_phase*I2S_FW <= I2S_TX_LEAD ? I2S_TX_LEAD/I2S_FW+1 : i2s_phase;
+		i2s_phase = i2s_phase >= i2s_frames ? i2s_frames-1 : i2s_phase;
+	}
+	i2s_out_xor = i2s_phase ? 1 : 0;
+	i2s_start_seq = i2s_ready_seq;
+	
+	if(i2s_phase)
+	{
+		/* preroll silence for phase frames then hand over to the output pair */
+		i2s_zero = 0;
+		dma_channel_config c = dma_channel_get_default_config(dma_chan_preroll);
+		channel_config_set_read_increment(&c,false);
+		channel_config_set_write_increment(&c,false);
+		channel_config_set_chain_to(&c, dma_chan_output[0]);
+		channel_config_set_dreq(&c,pio_get_dreq(pio,sm,true));
+		channel_config_set_transfer_data_size(&c, DMA_SIZE_32);
+		dma_channel_configure(
+			dma_chan_preroll,
+			&c,
+			&pio->txf[sm],	// Destination pointer
+			&i2s_zero,		// Source pointer
+			I2S_FW*i2s_phase,	// Number of transfers
+			false			// Started below
+		);
+		
+		/* start input and preroll together so the phase is exact */
+		dma_start_channel_mask((1u << dma_chan_input[0]) | (1u << dma_chan_preroll));
+	}
+	else
+	{
+		/* start first half of both directions together so they stay in phase */
+		dma_start_channel_mask((1u << dma_chan_input[0]) | (1u << dma_chan_output[0]));
+	}
+}
+
+/*
+ * unchain and stop all the dma channels
+ */
+static void i2s_fulldup_dma_stop(void)
+{
+	uint8_t i;
+	
+	for(i=0;i<2;i++)
+	{
+		/* break the chains first so an abort can't re-trigger the mate */
+		dma_channel_config c = dma_channel_get_default_config(dma_chan_input[i]);
+		channel_config_set_enable(&c, false);
+		dma_channel_set_config(dma_chan_input[i], &c, false);
+		dma_channel_config cc = dma_channel_get_default_config(dma_chan_output[i]);
+		channel_config_set_enable(&cc, false);
+		dma_channel_set_config(dma_chan_output[i], &cc, false);
+		dma_channel_set_irq0_enabled(dma_chan_input[i], false);
+	}
+	dma_channel_config c = dma_channel_get_default_config(dma_chan_preroll);
+	channel_config_set_enable(&c, false);
+	dma_channel_set_config(dma_chan_preroll, &c, false);
+	dma_channel_abort(dma_chan_preroll);
+	for(i=0;i<2;i++)
+	{
+		dma_channel_abort(dma_chan_input[i]);
+		dma_channel_abort(dma_chan_output[i]);
+		dma_hw->ints0 = 1u << dma_chan_input[i];
+	}
+}
+
+/*
+ * get round trip latency of the buffering in samples (excludes codec)
+ */
+uint16_t i2s_fulldup_get_latency(void)
+{
+	return i2s_phase ? i2s_frames + i2s_phase : 2*i2s_frames;
+}
+#else
 uint dma_chan_input, dma_chan_output;
 uint ib_idx, ob_idx;
-uint32_t input_buf[2*FRAMES_PER_BUFFER], output_buf[2*FRAMES_PER_BUFFER],
-	xfer_buf[FRAMES_PER_BUFFER];
+uint32_t i2s_block_cnt;
+
+/*
+ * Buffer ownership:
+ * input_buf[ib_idx] and output_buf[ob_idx] belong to the DMA. The other
+ * input half holds the block just captured and the other output half is
+ * the one that will be started by the next output IRQ, so Audio_Proc owns
+ * both of them and renders straight into the idle output half. Both IRQs
+ * run on the same core at the same priority so the output IRQ can't flip
+ * ob_idx while a block is being rendered.
+ */
 
 /*
  * IRQ0 handler - used only for I2S input
- * ATM this is not double-buffered, but it would be prudent to
- * do so if adding code to compute the next buffer.
  */
 void dma_input_handler(void)
 {
@@ -69,31 +401,26 @@ void dma_input_handler(void)
 	/* reset write address to start of next buffer */
 	ib_idx ^= 1;
 	dma_channel_set_write_addr(dma_chan_input,
-		&input_buf[ib_idx*FRAMES_PER_BUFFER],
+		&input_buf[ib_idx*I2S_FW*i2s_frames],
 		true
 	);
 	
 	/* start next transfer sequence */
 	dma_channel_start(dma_chan_input);
 	
-#if 0
-	/* save previous buffer */
-	memcpy(xfer_buf, &input_buf[ib_idx*FRAMES_PER_BUFFER],
-		FRAMES_PER_BUFFER*sizeof(uint32_t));
-#else
-	/* do audio processing on previous buffer */
-	Audio_Proc((int16_t *)xfer_buf,
-	(int16_t *)&input_buf[(ib_idx^1)*FRAMES_PER_BUFFER],
-		2*FRAMES_PER_BUFFER);
-#endif
+	/* process previous input buffer into the idle output buffer */
+	Audio_Proc((int32_t *)&output_buf[(ob_idx^1)*I2S_FW*i2s_frames],
+		(int32_t *)&input_buf[(ib_idx^1)*I2S_FW*i2s_frames],
+		2*i2s_frames);
+	
+	/* only FIFO stalls can be detected without the chained transport */
+	i2s_xrun_check(++i2s_block_cnt);
 
 	gpio_put(IN_DIAG_PIN, 0);
 }
 
 /*
  * IRQ1 handler - used only for I2S output
- * ATM this is not double-buffered, but it would be prudent to
- * do so if adding code to compute the next buffer.
  */
 void dma_output_handler()
 {
@@ -105,71 +432,486 @@ void dma_output_handler()
 	/* reset read address to start of next buffer */
 	ob_idx ^= 1;
 	dma_channel_set_read_addr(dma_chan_output,
-		&output_buf[ob_idx*FRAMES_PER_BUFFER],
+		&output_buf[ob_idx*I2S_FW*i2s_frames],
 		true
 	);
 	
-	/* start next transfer sequence */
+	/* start next transfer sequence - previous half is now free for Audio_Proc */
 	dma_channel_start(dma_chan_output);
 	
-	/* fill previous buffer with new data */
-#if 1
-	/* loopback */
-	memcpy(&output_buf[ob_idx*FRAMES_PER_BUFFER], xfer_buf,
-		FRAMES_PER_BUFFER*sizeof(uint32_t));
-#else
-	/* do audio processing */
-	Audio_Proc((int16_t *)&output_buf[ob_idx*FRAMES_PER_BUFFER],
-		(int16_t *)xfer_buf,
-		2*FRAMES_PER_BUFFER);
-#endif
-	
 	gpio_put(OUT_DIAG_PIN, 0);
 }
 
-#ifdef MULTICORE
 /*
- * entry point for 2nd core to start running
+ * nothing to do - rendering is done in the input IRQ
  */
-void core1_entry()
+void i2s_fulldup_service(void)
+{
+}
+
+/*
+ * never a block waiting outside the input IRQ
+ */
+static uint8_t i2s_fulldup_idle(void)
 {
+	return 1;
+}
+
+/*
+ * get round trip latency of the buffering in samples (excludes codec)
+ * The output phase is set by IRQ timing so it isn't known exactly.
+ */
+uint16_t i2s_fulldup_get_latency(void)
+{
+	return 2*i2s_frames;
+}
+
+/*
+ * configure the dma channels and start them
+ */
+static void i2s_fulldup_dma_start(void)
+{
+    /* configure dma channel for input */
+	ib_idx = 0;
+    dma_channel_config c = dma_channel_get_default_config(dma_chan_input);
+    channel_config_set_read_increment(&c,false);
+    channel_config_set_write_increment(&c,true);
+    channel_config_set_dreq(&c,pio_get_dreq(pio,sm,false));
+    channel_config_set_transfer_data_size(&c, DMA_SIZE_32);
+
+    dma_channel_configure(
+        dma_chan_input,
+        &c,
+        input_buf, 			// Destination pointer
+        &pio->rxf[sm], 		// Source pointer
+        I2S_FW*i2s_frames,	// Number of transfers
+        true				// Start immediately
+    );
+    dma_channel_set_irq0_enabled(dma_chan_input, true);
+
+    /* configure dma channel for output */
+	ob_idx = 0;
+    dma_channel_config cc = dma_channel_get_default_config(dma_chan_output);
+    channel_config_set_read_increment(&cc,true);
+    channel_config_set_write_increment(&cc,false);
+    channel_config_set_dreq(&cc,pio_get_dreq(pio,sm,true));
+    channel_config_set_transfer_data_size(&cc, DMA_SIZE_32);
+    dma_channel_configure(
+        dma_chan_output,
+        &cc,
+        &pio->txf[sm],		// Destination pointer
+        output_buf,			// Source pointer
+        I2S_FW*i2s_frames,	// Number of transfers
+        true				// Start immediately
+    );
+    dma_channel_set_irq1_enabled(dma_chan_output, true);
+}
+
+/*
+ * stop the dma channels
+ */
+static void i2s_fulldup_dma_stop(void)
+{
+	dma_channel_set_irq0_enabled(dma_chan_input, false);
+	dma_channel_set_irq1_enabled(dma_chan_output, false);
+	dma_channel_abort(dma_chan_input);
+	dma_channel_abort(dma_chan_output);
+	dma_irqn_acknowledge_channel(DMA_IRQ_0, dma_chan_input);
+	dma_irqn_acknowledge_channel(DMA_IRQ_1, dma_chan_output);
+}
+#endif
+
+/*
+ * hook up the DMA IRQ handlers and profiler on the calling core
+ */
+static void i2s_fulldup_irq_init(void)
+{
+	/* profiler uses the SysTick of the core that does the processing */
+	prof_init();
+	
 	/* enable IRQ handler for dma input */
     irq_set_exclusive_handler(DMA_IRQ_0, dma_input_handler);
     irq_set_enabled(DMA_IRQ_0, true);
-	
 
+#ifndef CHAINED_DMA
 	/* enable IRQ handler for dma output */
     irq_set_exclusive_handler(DMA_IRQ_1, dma_output_handler);
     irq_set_enabled(DMA_IRQ_1, true);
+#endif
+}
+
+#ifdef MULTICORE
+/*
+ * entry point for 2nd core to start running
+ */
+void core1_entry()
+{
+	uint32_t irqs;
+	
+	/* enable IRQ handlers */
+	i2s_fulldup_irq_init();
 	
 	/* enable multicore lockout */
 	multicore_lockout_victim_init();
 
-	/* loop here waiting for IRQs */
+	/* loop here waiting for blocks */
 	while(1)
 	{
-		Audio_Fore();
+		i2s_fulldup_service();
+		
+		/* stop here if core 0 is rearranging things, then pick up the new transport */
+		if(Audio_Park_Point())
+			i2s_done_seq = i2s_start_seq;
+		
+		/* sleep until the next IRQ - masked so a block posted after the check still wakes the wfi */
+		irqs = save_and_disable_interrupts();
+		if(i2s_fulldup_idle())
+			__wfi();
+		restore_interrupts(irqs);
 	}
 }
 #endif
 
 /*
- * initialize the I2S processing
+ * set the PIO divider and MCLK for a sample rate
  */
-void init_i2s_fulldup(void)
+static void i2s_fulldup_clocks(uint32_t sample_freq)
 {
-	int32_t i;
-	int16_t *obuf = (int16_t *)output_buf;
-	int16_t *ibuf = (int16_t *)input_buf;
+	const clkplan_entry *plan;
+	uint32_t divider, mdiv;
+	
+	/* move clk_sys to an exact multiple of MCLK for this rate if possible */
+	plan = clkplan_set_rate(sample_freq);
 	
-	/* clear buffers */
-	for(i=0;i<2*FRAMES_PER_BUFFER;i++)
+	/* compute PIO divider for desired sample rate */
+    uint32_t system_clock_frequency = clock_get_hz(clk_sys);
+	fx_set_clock(system_clock_frequency);
+    assert(system_clock_frequency < 0x40000000);
+    printf("System clock %u Hz\n", (uint) system_clock_frequency);
+    printf("Target sample freq %d\n", sample_freq);
+	/* PIO runs 4 instructions per bit so PIO clock is 8*I2S_SLOT_BITS*fs */
+	if(plan)
+		divider = plan->mdiv*(256*32/I2S_SLOT_BITS);
+	else
 	{
-		*ibuf++ = 0;
-		*ibuf++ = 0;
-		*obuf++ = 0;
-		*obuf++ = 0;
+		divider = system_clock_frequency / (I2S_SLOT_BITS * sample_freq / 32); // avoid arithmetic overflow
+		divider = divider & ~((256*32/I2S_SLOT_BITS)-1); // mask off bottom bits for exact MCLK/PIO clock ratio
 	}
+    assert(divider < 0x1000000);
+    printf("PIO clock divider 0x%x/256\n", divider);
+	printf("Actual sample freq = %d\n", system_clock_frequency / (I2S_SLOT_BITS * divider / 32));
+    pio_sm_set_clkdiv_int_frac(pio, sm, divider >> 8u, divider & 0xffu);
+	
+	/* generate an MCLK on GPIO at 256x LRCK - 4x BCLK for 32-bit slots */
+	mdiv = divider*I2S_SLOT_BITS/(256*32);
+	clock_gpio_init(I2S_MCLK_PIN, CLOCKS_CLK_GPOUT1_CTRL_AUXSRC_VALUE_CLK_SYS, mdiv);
+	printf("MCLK at %d Hz\n", system_clock_frequency/mdiv);
+	
+	i2s_rate = sample_freq;
+}
+
+/*
+ * carve the I2S buffers for the current block size out of the pool
+ */
+static void i2s_fulldup_carve(void)
+{
+	input_buf = i2s_pool;
+	output_buf = &i2s_pool[2*I2S_FW*i2s_frames];
+	memset(i2s_pool, 0, sizeof(i2s_pool));
+}
+
+/*
+ * get the current block size in frames
+ */
+uint16_t i2s_fulldup_get_frames(void)
+{
+	return i2s_frames;
+}
+
+/*
+ * stop the transport, apply new settings and restart - only used by core 0
+ * returns 1 with nothing changed if the audio core couldn't be stopped
+ */
+static uint8_t i2s_fulldup_restart(uint16_t frames, uint8_t lowlat, uint32_t rate)
+{
+#ifndef MULTICORE
+	uint32_t irqs;
+#endif
+	
+	/* mute and park the audio core between blocks while the buffers are rearranged */
+	Audio_Wait_Mute(Audio_Set_Mute(1));
+#ifdef MULTICORE
+	if(Audio_Park(1))
+	{
+		Audio_Set_Mute(0);
+		printf("i2s_fulldup_restart: audio core didn't park, nothing changed\n");
+		return 1;
+	}
+#else
+	irqs = save_and_disable_interrupts();
+#endif
+	
+	/* stop transport */
+	pio_sm_set_enabled(pio, sm, false);
+	i2s_fulldup_dma_stop();
+	
+	/*
+	 * new rate needs the PIO and MCLK dividers and the codec changed, done
+	 * here while nothing's running. The effects get it through the command
+	 * ring so it lands between blocks on the audio core.
+	 */
+	if(rate != i2s_rate)
+	{
+		i2s_fulldup_clocks(rate);
+		WM8731_SetRate(rate);
+#ifdef MULTICORE
+		Audio_Set_Rate(rate);
+#else
+		fx_set_rate(rate);
+#endif
+	}
+	
+	/* set up new buffers */
+	i2s_frames = frames;
+#ifdef CHAINED_DMA
+	i2s_lowlat = lowlat;
+#endif
+	i2s_fulldup_carve();
+	
+	/* restart PIO from a clean state and then the transport */
+	pio_sm_clear_fifos(pio, sm);
+	pio->fdebug = ((1u << PIO_FDEBUG_TXSTALL_LSB) | (1u << PIO_FDEBUG_RXSTALL_LSB)) << sm;
+	pio_sm_restart(pio, sm);
+	pio_sm_clkdiv_restart(pio, sm);
+	pio_sm_exec(pio, sm, pio_encode_set(pio_y, I2S_SLOT_BITS - 2));
+	pio_sm_exec(pio, sm, pio_encode_jmp(pio_offset + i2s_fulldup_offset_entry_point));
+	i2s_fulldup_dma_start();
+	pio_sm_set_enabled(pio, sm, true);
+	
+#ifdef MULTICORE
+	Audio_Park(0);
+#else
+#ifdef CHAINED_DMA
+	i2s_done_seq = i2s_start_seq;
+#endif
+	restore_interrupts(irqs);
+#endif
+	Audio_Set_Mute(0);
+	
+	printf("i2s_fulldup_restart: %d Hz, %d frames/block, %d samples latency\n",
+		i2s_rate, i2s_frames, i2s_fulldup_get_latency());
+	
+	return 0;
+}
+
+/*
+ * change the block size on the fly - only used by core 0
+ * frames must be a power of 2 from SMPS_MIN to SMPS_MAX
+ */
+uint8_t i2s_fulldup_set_frames(uint16_t frames)
+{
+	if((frames < SMPS_MIN) || (frames > SMPS_MAX) || (frames & (frames-1)))
+		return 1;
+	
+	if(frames != i2s_frames)
+		return i2s_fulldup_restart(frames, i2s_fulldup_get_lowlat(), i2s_rate);
+	
+	return 0;
+}
+
+/*
+ * get the low latency output phase in 1/4 blocks, 0 = off
+ */
+uint8_t i2s_fulldup_get_lowlat(void)
+{
+#ifdef CHAINED_DMA
+	return i2s_lowlat;
+#else
+	return 0;
+#endif
+}
+
+/*
+ * set the low latency output phase in 1/4 blocks, 0 = off - only used by core 0
+ * The phase is the processing deadline after a block arrives so it must
+ * cover the worst case algorithm load. Needs the chained transport.
+ */
+uint8_t i2s_fulldup_set_lowlat(uint8_t lowlat)
+{
+#ifdef CHAINED_DMA
+	if(lowlat > 3)
+		return 1;
+	
+	if(lowlat != i2s_lowlat)
+		return i2s_fulldup_restart(i2s_frames, lowlat, i2s_rate);
+	
+	return 0;
+#else
+	return lowlat ? 1 : 0;
+#endif
+}
+
+/*
+ * get the current sample rate
+ */
+uint32_t i2s_fulldup_get_rate(void)
+{
+	return i2s_rate;
+}
+
+/*
+ * change the clock profile on the fly - only used by core 0
+ */
+uint8_t i2s_fulldup_set_profile(uint8_t profile)
+{
+	uint32_t rate = i2s_rate;
+	uint8_t prev = clkplan_get_profile();
+	
+	if(clkplan_set_profile(profile))
+		return 1;
+	
+	/* forget the current rate so the restart re-plans the clocks */
+	i2s_rate = 0;
+	if(i2s_fulldup_restart(i2s_frames, i2s_fulldup_get_lowlat(), rate))
+	{
+		/* clocks weren't touched so put the profile back to match them */
+		clkplan_set_profile(prev);
+		i2s_rate = rate;
+		return 1;
+	}
+	
+	return 0;
+}
+
+/*
+ * hold the audio core between blocks with the output silent so core 0 has
+ * the bus to itself, or let it go again - only used by core 0. Returns 1 if
+ * it couldn't be held, in which case audio keeps running muted. Without
+ * MULTICORE the audio IRQ shares core 0 and just renders silence.
+ */
+uint8_t i2s_fulldup_hold(uint8_t hold)
+{
+	if(hold)
+	{
+		Audio_Wait_Mute(Audio_Set_Mute(1));
+#ifdef MULTICORE
+		if(Audio_Park(1))
+		{
+			printf("i2s_fulldup_hold: audio core didn't park\n");
+			return 1;
+		}
+		
+		/* the DMA keeps looping over the output halves so clear them */
+		memset(output_buf, 0, 2*I2S_FW*i2s_frames*sizeof(uint32_t));
+		i2s_held = 1;
+#endif
+		return 0;
+	}
+	
+#ifdef MULTICORE
+	/* blocks that came in while held were never due so pick up from here */
+	if(i2s_held)
+	{
+		i2s_start_seq = i2s_ready_seq;
+		Audio_Park(0);
+		i2s_held = 0;
+	}
+#endif
+	Audio_Set_Mute(0);
+	
+	return 0;
+}
+
+/*
+ * change the sample rate on the fly - only used by core 0
+ * rate must be one the codec supports, from clkplan_rates
+ */
+uint8_t i2s_fulldup_set_rate(uint32_t rate)
+{
+	if(clkplan_rate_index(rate) == CLKPLAN_NUM_RATES)
+		return 1;
+	
+	if(rate != i2s_rate)
+		return i2s_fulldup_restart(i2s_frames, i2s_fulldup_get_lowlat(), rate);
+	
+	return 0;
+}
+
+/*
+ * get xrun counts by cause and return the total
+ */
+uint32_t i2s_fulldup_get_xruns(uint32_t *counts)
+{
+	uint32_t i, total = 0;
+	
+	for(i=0;i<XRUN_NUM_CAUSES;i++)
+	{
+		if(counts)
+			counts[i] = i2s_xrun_cnt[i];
+		total += i2s_xrun_cnt[i];
+	}
+	
+	return total;
+}
+
+/*
+ * copy xrun log newest first and return the number of entries
+ */
+uint8_t i2s_fulldup_get_xrun_log(i2s_xrun_entry *log)
+{
+	uint32_t seq, total, i;
+	
+	do
+	{
+		seq = i2s_xrun_seq;
+		__dmb();
+		total = i2s_xrun_total;
+		for(i=0;(i<XRUN_LOG_LEN)&&(i<total);i++)
+			log[i] = i2s_xrun_log[(total-1-i) & (XRUN_LOG_LEN-1)];
+		__dmb();
+	}
+	while((seq & 1) || (seq != i2s_xrun_seq));
+	
+	return i;
+}
+
+/*
+ * ask the audio core to clear the xrun counts and log
+ */
+void i2s_fulldup_clear_xruns(void)
+{
+	i2s_xrun_clr_req = 1;
+}
+
+/*
+ * print xrun counts and log
+ */
+void i2s_fulldup_xrun_report(void)
+{
+	static i2s_xrun_entry log[XRUN_LOG_LEN];
+	uint32_t counts[XRUN_NUM_CAUSES];
+	uint8_t i, n;
+	
+	printf("Xruns: %d total", i2s_fulldup_get_xruns(counts));
+	for(i=0;i<XRUN_NUM_CAUSES;i++)
+		printf(", %s %d", i2s_xrun_names[i], counts[i]);
+	printf("\n");
+	
+	n = i2s_fulldup_get_xrun_log(log);
+	for(i=0;i<n;i++)
+		printf("  %6d.%06d s  block %8d  %-6s %d\n", log[i].time/1000000,
+			log[i].time%1000000, log[i].block, i2s_xrun_names[log[i].cause],
+			log[i].count);
+}
+
+/*
+ * initialize the I2S processing
+ */
+void init_i2s_fulldup(void)
+{
+	/* set up initial buffers */
+	i2s_frames = SMPS;
+	i2s_fulldup_carve();
 
 	/* diag GPIO */
 	gpio_init(IN_DIAG_PIN);
@@ -179,88 +921,51 @@ void init_i2s_fulldup(void)
 
     /* set up PIO */
     pio = pio0;
-    uint offset = pio_add_program(pio, &i2s_fulldup_program);
-    printf("loaded program at offset: %i\n", offset);
+    pio_offset = pio_add_program(pio, &i2s_fulldup_program);
+    printf("loaded program at offset: %i\n", pio_offset);
     sm = pio_claim_unused_sm(pio, true);
     printf("claimed sm: %i\n", sm);
 	
-	/* compute PIO divider for desired sample rate */
-    uint32_t system_clock_frequency = clock_get_hz(clk_sys);
-    assert(system_clock_frequency < 0x40000000);
-    printf("System clock %u Hz\n", (uint) system_clock_frequency);
-    uint32_t sample_freq = 48000;
-    printf("Target sample freq %d\n", sample_freq);
-    uint32_t divider = system_clock_frequency * 2 / sample_freq; // avoid arithmetic overflow
-    divider = divider & ~(0x1ff); // mask off bottom 9 for exact MCLK/BCLK ratio of 4.0
-    assert(divider < 0x1000000);
-    printf("PIO clock divider 0x%x/256\n", divider);
-	printf("Actual sample freq = %d\n", 2 * system_clock_frequency / divider);
-	
-	/* set up the PIO and divider */
+	/* set up the PIO */
     i2s_fulldup_program_init(
 		pio,
 		sm,
-		offset,
+		pio_offset,
 		I2S_DO_PIN,
 		I2S_DI_PIN,
-		I2S_CLK_PIN_BASE
+		I2S_CLK_PIN_BASE,
+		I2S_SLOT_BITS
 	);
-    pio_sm_set_clkdiv_int_frac(pio, sm, divider >> 8u, divider & 0xffu);
 	
-	/* generate an MCLK on GPIO at 8x BCLK (256x LRCK) */
+	/* set PIO divider and MCLK for the default rate */
 	gpio_set_function(I2S_MCLK_PIN, GPIO_FUNC_GPCK);
-	clock_gpio_init(I2S_MCLK_PIN, CLOCKS_CLK_GPOUT1_CTRL_AUXSRC_VALUE_CLK_SYS, divider>>9);
-	printf("MCLK at %d Hz\n", system_clock_frequency/(divider>>9));
+	i2s_fulldup_clocks(SAMPLE_RATE);
+	fx_set_rate(i2s_rate);
 	
-    /* configure dma channel for input */
-	ib_idx = 0;
+#ifdef CHAINED_DMA
+	/* claim channel pairs and preroll */
+	for(uint8_t i=0;i<2;i++)
+	{
+		dma_chan_input[i] = dma_claim_unused_channel(true);
+		dma_chan_output[i] = dma_claim_unused_channel(true);
+	}
+	dma_chan_preroll = dma_claim_unused_channel(true);
+	i2s_lowlat = 0;
+	printf("DMA input using chls %d/%d, output using chls %d/%d, preroll chl %d\n",
+		dma_chan_input[0], dma_chan_input[1],
+		dma_chan_output[0], dma_chan_output[1], dma_chan_preroll);
+#else
     dma_chan_input = dma_claim_unused_channel(true);
 	printf("DMA input using chl %d\n", dma_chan_input);
-    dma_channel_config c = dma_channel_get_default_config(dma_chan_input);
-    channel_config_set_read_increment(&c,false);
-    channel_config_set_write_increment(&c,true);
-    channel_config_set_dreq(&c,pio_get_dreq(pio,sm,false));
-    channel_config_set_transfer_data_size(&c, DMA_SIZE_32);
-
-    dma_channel_configure(
-        dma_chan_input,
-        &c,
-        input_buf, 			// Destination pointer
-        &pio->rxf[sm], 		// Source pointer
-        FRAMES_PER_BUFFER, // Number of transfers
-        true				// Start immediately
-    );
-    dma_channel_set_irq0_enabled(dma_chan_input, true);
-
-    /* configure dma channel for output */
-	ob_idx = 0;
 	dma_chan_output = dma_claim_unused_channel(true);
 	printf("DMA output using chl %d\n", dma_chan_output);
-    dma_channel_config cc = dma_channel_get_default_config(dma_chan_output);
-    channel_config_set_read_increment(&cc,true);
-    channel_config_set_write_increment(&cc,false);
-    channel_config_set_dreq(&cc,pio_get_dreq(pio,sm,true));
-    channel_config_set_transfer_data_size(&cc, DMA_SIZE_32);
-    dma_channel_configure(
-        dma_chan_output,
-        &cc,
-        &pio->txf[sm],		// Destination pointer
-        output_buf,			// Source pointer
-        FRAMES_PER_BUFFER,	// Number of transfers
-        true				// Start immediately
-    );
-    dma_channel_set_irq1_enabled(dma_chan_output, true);
+#endif
+	i2s_fulldup_dma_start();
+	printf("DMA using %d frames/block\n", i2s_frames);
     
 #ifndef MULTICORE
 	/* No multi-core - just use core 0 */
-	
-	/* enable IRQ handler for dma input */
-    irq_set_exclusive_handler(DMA_IRQ_0, dma_input_handler);
-    irq_set_enabled(DMA_IRQ_0, true);
-
-	/* enable IRQ handler for dma output */
-    irq_set_exclusive_handler(DMA_IRQ_1, dma_output_handler);
-    irq_set_enabled(DMA_IRQ_1, true);
+	i2s_fulldup_irq_init();
 	
 	printf("Single core background started\n");
 #else
@@ -7,6 +7,44 @@
 
 #include "main.h"
 
+#define XRUN_LOG_LEN 16		// must be a power of 2
+
+/*
+ * xrun causes
+ */
+enum i2s_xrun_causes
+{
+	XRUN_OVERRUN,	// blocks skipped - count is # of blocks not rendered
+	XRUN_LATE,		// render finished after output DMA started - count is stale frames
+	XRUN_TXSTALL,	// PIO ran out of output data
+	XRUN_RXSTALL,	// PIO input FIFO overflowed
+	XRUN_NUM_CAUSES
+};
+
+typedef struct
+{
+	uint32_t time;		// time_us_32() when detected
+	uint32_t block;		// block sequence number
+	uint8_t cause;
+	uint16_t count;
+} i2s_xrun_entry;
+
+extern const char *i2s_xrun_names[XRUN_NUM_CAUSES];
+
 void init_i2s_fulldup(void);
+void i2s_fulldup_service(void);
+uint16_t i2s_fulldup_get_frames(void);
+uint8_t i2s_fulldup_set_frames(uint16_t frames);
+uint8_t i2s_fulldup_get_lowlat(void);
+uint8_t i2s_fulldup_set_lowlat(uint8_t lowlat);
+uint16_t i2s_fulldup_get_latency(void);
+uint32_t i2s_fulldup_get_rate(void);
+uint8_t i2s_fulldup_set_rate(uint32_t rate);
+uint8_t i2s_fulldup_set_profile(uint8_t profile);
+uint8_t i2s_fulldup_hold(uint8_t hold);
+uint32_t i2s_fulldup_get_xruns(uint32_t *counts);
+uint8_t i2s_fulldup_get_xrun_log(i2s_xrun_entry *log);
+void i2s_fulldup_clear_xruns(void);
+void i2s_fulldup_xrun_report(void);
 
 #endif
\ No newline at end of file
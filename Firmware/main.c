@@ -16,6 +16,8 @@
 #include "adc.h"
 #include "gfx.h"
 #include "menu.h"
+#include "console.h"
+#include "clkplan.h"
 #include "splash.h"
 
 /* build version in simple format */
@@ -35,6 +37,9 @@ int main()
 	char textbuf[32];
 	pico_unique_board_id_t id_out;
 	
+	/* peripheral clocks must be settled before stdio starts */
+	clkplan_init();
+	
 	/* startup msg */
     stdio_init_all();
 	printf("\n\nRP2040_Audio - Audio DSP module %s starting\n\r", fwVersionStr);
@@ -88,6 +93,7 @@ int main()
 	/* init menu */
     printf("Init menu\n");
 	menu_init();
+	console_init();
 	
 	/* loop here forever */
 	printf("Looping...\n");
@@ -95,6 +101,7 @@ int main()
     {
 		//printf("%1d 0x%03X 0x%03X\r", button_get(), ADC_val[0], ADC_val[1]);
 		menu_update();
+		console_update();
 	}
 
 	/* should never get here */
@@ -34,7 +34,7 @@ enum tags
 };
 
 static int16_t menu_item_values[FX_NUM_ALGOS][MENU_MAX_PARAMS];
-static uint8_t menu_reset, menu_act_item;
+static uint8_t menu_reset, menu_act_item, menu_xrun_page;
 static uint16_t menu_algo, menu_save_counter;
 static uint64_t menu_time;
 static char txtbuf[32];
@@ -49,31 +49,35 @@ void menu_save_state(void)
 	printf("menu_save_state: committing tags to flash\n");
 	
 	/* mute */
-	Audio_Set_Mute(1);
+	Audio_Wait_Mute(Audio_Set_Mute(1));
 	printf("muted\n");
 	
 	/* shut down core 0 IRQs */
 	irqs = save_and_disable_interrupts();
 	printf("core 0 irq disabled\n");
 	
-	/* shut down core 1 IRQs */
-	Audio_Disable_Core(1);
-	printf("core 1 blocked\n");
+	/* shut down core 1 IRQs - flash can't be written while it may be running from it */
+	if(Audio_Disable_Core(1))
+		printf("core 1 didn't respond, not committed\n");
+	else
+	{
+		printf("core 1 blocked\n");
 
-	/* commit tags to flash */
-	nvs_commit();
-	printf("committed\n");
+		/* commit tags to flash */
+		nvs_commit();
+		printf("committed\n");
 
-	/* re-enable core 1 IRQs */
-	Audio_Disable_Core(0);
-	printf("core 1 unblocked\n");
+		/* re-enable core 1 IRQs */
+		Audio_Disable_Core(0);
+		printf("core 1 unblocked\n");
+	}
 
 	/* re-enable core 0 IRQs */
 	restore_interrupts(irqs);
 	printf("core 0 irq enabled\n");
 	
 	/* unmute */
-	Audio_Set_Mute(0);			// hangs if flash was written
+	Audio_Set_Mute(0);
 	printf("unmuted\n");
 }
 
@@ -102,7 +106,7 @@ uint8_t menu_load_state(void)
 		commit = 1;
 		printf("menu_load_state: created tag %d [menu_algo] = %d\n", tag, raw_param);
 	}
-	menu_algo = raw_param;
+	menu_algo = fx_find_id(raw_param);
 	
 	tag = TAG_ACT;
 	raw_param = 0;
@@ -123,7 +127,7 @@ uint8_t menu_load_state(void)
 	{
 		for(j=0;j<MENU_MAX_PARAMS;j++)
 		{
-			tag = (i+1)<<2|j;
+			tag = (fx_ids[i]+1)<<2|j;
 			raw_param = 0;
 			
 			if(!nvs_get_tag(tag, &raw_param))
@@ -154,6 +158,27 @@ uint8_t menu_load_state(void)
 	return 0;
 }
 
+/*
+ * draw the xrun log in place of the params
+ */
+void menu_render_xruns(void)
+{
+	static i2s_xrun_entry log[XRUN_LOG_LEN];
+	uint8_t i, n;
+	
+	n = i2s_fulldup_get_xrun_log(log);
+	for(i=0;i<7;i++)
+	{
+		if(i<n)
+			sprintf(txtbuf, "%-6s%4d %5d.%03d", i2s_xrun_names[log[i].cause],
+				log[i].count > 9999 ? 9999 : log[i].count,
+				(log[i].time/1000000)%100000, (log[i].time/1000)%1000);
+		else
+			sprintf(txtbuf, "%20s", i ? "" : "No xruns");
+		gfx_drawstr(0, i*10+10, txtbuf);
+	}
+}
+
 /*
  * periodic menu updates
  */
@@ -162,6 +187,7 @@ void menu_timer_callback(void)
 	/* update load */
 	gfx_set_forecolor(GFX_WHITE);
 	uint64_t load;
+	uint32_t xruns;
 	
 	/* update load indicator */
 	if(audio_period != 0)
@@ -171,6 +197,14 @@ void menu_timer_callback(void)
 		gfx_drawstr(40, 0, txtbuf);
 	}
 	
+	/* update xrun count */
+	xruns = i2s_fulldup_get_xruns(NULL);
+	if(xruns)
+		gfx_set_forecolor(GFX_RED);
+	sprintf(txtbuf, "X:%-4d", xruns > 9999 ? 9999 : xruns);
+	gfx_drawstr(80, 0, txtbuf);
+	gfx_set_forecolor(GFX_WHITE);
+	
 	/* update state save */
 	if(menu_save_counter != 0)
 	{
@@ -187,6 +221,14 @@ void menu_timer_callback(void)
 	}
 
 	menu_item_values[menu_algo][menu_act_item] = ADC_param[menu_act_item];
+	
+	/* xrun log replaces params, mix and meters */
+	if(menu_xrun_page)
+	{
+		menu_render_xruns();
+		return;
+	}
+	
 	fx_render_parm(menu_act_item);
 	
 	/* update mix */
@@ -213,14 +255,14 @@ void menu_sched_save(uint8_t mask)
 	
 	if(mask & SAVE_ALGO)
 	{
-		nvs_put_tag(TAG_ALGO, menu_algo);
+		nvs_put_tag(TAG_ALGO, fx_ids[menu_algo]);
 		printf("menu_sched_save: Scheduling menu_algo = %d save\n",
 			menu_algo);
 	}
 	
 	if(mask & SAVE_VALUE)
 	{
-		uint8_t tag = (menu_algo+1)<<2|menu_act_item;
+		uint8_t tag = (fx_ids[menu_algo]+1)<<2|menu_act_item;
 		nvs_put_tag(tag, menu_item_values[menu_algo][menu_act_item]);
 		printf("menu_sched_save: Scheduling [%s:%d] = %d save\n",
 			effects[menu_algo]->name, menu_act_item,
@@ -243,6 +285,10 @@ void menu_render(void)
 	char *name;
 	GFX_RECT rect;
 	
+	/* nothing to do while showing xruns */
+	if(menu_xrun_page)
+		return;
+	
 	/* set constants */
 	gfx_set_forecolor(GFX_WHITE);
 	GFX_COLOR fgcolor = gfx_get_forecolor(), bgcolor = gfx_get_backcolor();
@@ -339,6 +385,31 @@ void menu_render(void)
 	}
 }
 
+/*
+ * toggle between the xrun log and the normal menu
+ */
+void menu_toggle_xruns(void)
+{
+	GFX_RECT rect;
+	
+	menu_xrun_page ^= 1;
+	if(menu_xrun_page)
+	{
+		rect.x0 = 0;
+		rect.y0 = 9;
+		rect.x1 = 159;
+		rect.y1 = 79;
+		gfx_clrrect(&rect);
+		menu_render_xruns();
+	}
+	else
+	{
+		gfx_clrscreen();
+		menu_reset = 1;
+		menu_render();
+	}
+}
+
 /*
  * initialize menu handler
  */
@@ -360,7 +431,7 @@ void menu_init(void)
 		ADC_setparamval(i, menu_item_values[menu_algo][i]);
 	printf("menu_init: ADC_forceactparam.\n");
 	ADC_forceactparam();
-	printf("menu_init: fx_select_algo.\n");	// hangs
+	printf("menu_init: fx_select_algo.\n");
 	fx_select_algo(menu_algo);
 	printf("menu_init: Audio_Set_Mute.\n");
 	Audio_Set_Mute(0);	// initial unmute after algo selected
@@ -385,6 +456,13 @@ void menu_update(void)
 	/* look for button press */
 	if(button_re())
 	{
+		/* any press leaves the xrun log */
+		if(menu_xrun_page)
+		{
+			menu_toggle_xruns();
+			return;
+		}
+		
 		/* save value of currently selected param */
 		menu_sched_save(SAVE_VALUE);
 		
@@ -408,14 +486,12 @@ void menu_update(void)
 		if(dsp_ratio_hyst_arb(&menu_algo, ADC_param[0]&0xfff, FX_NUM_ALGOS-1))
 		{
 			printf("menu_update: algo = %d\n", menu_algo);
-			Audio_Set_Mute(1);
 			menu_sched_save(SAVE_ALGO);
 			fx_select_algo(menu_algo);
 			for(int i=1;i<MENU_MAX_PARAMS;i++)
-				ADC_setparamval(i, menu_item_values[menu_algo][i]);
+				Audio_Set_Param(i, menu_item_values[menu_algo][i]);
 			menu_reset = 1;
 			menu_render();
-			Audio_Set_Mute(0);
 		}
 	}
 	
@@ -10,5 +10,6 @@
 
 void menu_init(void);
 void menu_update(void);
+void menu_toggle_xruns(void);
 
 #endif
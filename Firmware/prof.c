@@ -0,0 +1,146 @@
+/*
+ * prof.c - cycle level profiler for the audio path
+ * 10-17-26 E. Brombaugh
+ *
+ * Stages are timed with the SysTick of the audio core which counts down
+ * at clk_sys, so a timestamp is a single 32-bit load. The audio core only
+ * ever writes the stats and brackets each update with a sequence count
+ * so other cores can take consistent snapshots without blocking it.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "hardware/sync.h"
+#include "prof.h"
+
+prof_stat prof_stats[PROF_NUM_STATS];
+volatile uint32_t prof_seq;
+static volatile uint8_t prof_reset_req;
+static uint32_t prof_prev_start;
+static uint8_t prof_primed;
+
+const char *prof_names[PROF_NUM_STATS] =
+{
+	"InLvl",
+	"Fx",
+	"Out",
+	"Total",
+	"Period",
+};
+
+/*
+ * clear all stats - only from the audio core
+ */
+static void prof_clear(void)
+{
+	uint8_t i;
+	
+	memset(prof_stats, 0, sizeof(prof_stats));
+	for(i=0;i<PROF_NUM_STATS;i++)
+		prof_stats[i].min = 0xffffffff;
+	prof_primed = 0;
+	prof_reset_req = 0;
+}
+
+/*
+ * start SysTick free-running on the calling core - call from the audio core
+ */
+void prof_init(void)
+{
+	prof_start();
+	
+	prof_seq = 0;
+	prof_clear();
+}
+
+/*
+ * add one measurement to a stat
+ */
+static inline void prof_update(prof_stat *st, uint32_t cyc)
+{
+	st->last = cyc;
+	st->min = cyc < st->min ? cyc : st->min;
+	st->max = cyc > st->max ? cyc : st->max;
+	st->cnt++;
+	st->sum += cyc;
+	st->hist[cyc ? 32-__builtin_clz(cyc) : 0]++;
+}
+
+/*
+ * update all stats from the stage timestamps of one block
+ * t[] holds the start of each stage plus the end of the last one
+ */
+void __not_in_flash_func(prof_block)(uint32_t *t)
+{
+	uint8_t i;
+	
+	prof_seq++;
+	__dmb();
+	
+	if(prof_reset_req)
+		prof_clear();
+	
+	/* SysTick counts down so elapsed is earlier - later */
+	for(i=0;i<PROF_NUM_STAGES;i++)
+		prof_update(&prof_stats[i], (t[i] - t[i+1]) & PROF_MASK);
+	prof_update(&prof_stats[PROF_TOTAL], (t[0] - t[PROF_NUM_STAGES]) & PROF_MASK);
+	
+	if(prof_primed)
+		prof_update(&prof_stats[PROF_PERIOD], (prof_prev_start - t[0]) & PROF_MASK);
+	prof_prev_start = t[0];
+	prof_primed = 1;
+	
+	__dmb();
+	prof_seq++;
+}
+
+/*
+ * take a consistent copy of the stats - never stalls the audio core
+ */
+void prof_snapshot(prof_stat *dst)
+{
+	uint32_t seq;
+	
+	do
+	{
+		seq = prof_seq;
+		__dmb();
+		memcpy(dst, prof_stats, sizeof(prof_stats));
+		__dmb();
+	}
+	while((seq & 1) || (seq != prof_seq));
+}
+
+/*
+ * ask the audio core to clear stats at the next block
+ */
+void prof_reset(void)
+{
+	prof_reset_req = 1;
+}
+
+/*
+ * print a snapshot of the stats
+ */
+void prof_report(void)
+{
+	static prof_stat snap[PROF_NUM_STATS];
+	uint8_t i, j;
+	
+	prof_snapshot(snap);
+	
+	printf("Stage      min      avg      max  cycles/block over %d blocks\n",
+		snap[PROF_TOTAL].cnt);
+	for(i=0;i<PROF_NUM_STATS;i++)
+	{
+		if(!snap[i].cnt)
+			continue;
+		
+		printf("%-6s %8u %8u %8u  hist:", prof_names[i], snap[i].min,
+			(uint32_t)(snap[i].sum/snap[i].cnt), snap[i].max);
+		for(j=0;j<PROF_HIST_BINS;j++)
+			if(snap[i].hist[j])
+				printf(" <2^%d:%u", j, snap[i].hist[j]);
+		printf("\n");
+	}
+}
@@ -0,0 +1,67 @@
+/*
+ * prof.h - cycle level profiler for the audio path
+ * 10-17-26 E. Brombaugh
+ */
+
+#ifndef __prof__
+#define __prof__
+
+#include "main.h"
+#include "hardware/structs/systick.h"
+
+/*
+ * stages timed in Audio_Proc, in the order they run
+ */
+enum prof_stages
+{
+	PROF_IN_LVL,
+	PROF_FX,
+	PROF_OUT,		// W/D mix, mute and output level
+	PROF_NUM_STAGES,
+	PROF_TOTAL = PROF_NUM_STAGES,	// whole block
+	PROF_PERIOD,					// start to start of blocks
+	PROF_NUM_STATS
+};
+
+#define PROF_MASK 0xffffff		// SysTick is a 24-bit down counter
+#define PROF_HIST_BINS 25		// log2 histogram, bin n is < 2^n cycles
+
+typedef struct
+{
+	uint32_t last;
+	uint32_t min;
+	uint32_t max;
+	uint32_t cnt;
+	uint64_t sum;
+	uint32_t hist[PROF_HIST_BINS];
+} prof_stat;
+
+extern prof_stat prof_stats[PROF_NUM_STATS];
+extern const char *prof_names[PROF_NUM_STATS];
+
+/*
+ * start SysTick free-running at clk_sys on the calling core
+ */
+static inline void prof_start(void)
+{
+	systick_hw->csr = 0;
+	systick_hw->rvr = PROF_MASK;
+	systick_hw->cvr = 0;
+	systick_hw->csr = M0PLUS_SYST_CSR_ENABLE_BITS | M0PLUS_SYST_CSR_CLKSOURCE_BITS;
+}
+
+/*
+ * current cycle count from the SysTick of the calling core
+ */
+static inline uint32_t prof_now(void)
+{
+	return systick_hw->cvr;
+}
+
+void prof_init(void);
+void prof_block(uint32_t *t);
+void prof_snapshot(prof_stat *dst);
+void prof_reset(void);
+void prof_report(void);
+
+#endif
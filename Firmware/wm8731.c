@@ -26,7 +26,7 @@ const uint16_t w8731_init_data[W8731_NUM_REGS] =
 	0x012,			// Reg 04: Analog Audio Path Control (DAC sel, Mute Mic)
 	0x000,			// Reg 05: Digital Audio Path Control (mute on = 0x8)
 	0x060,			// Reg 06: Power Down Control (Clkout, Osc, Mic Off)
-	0x002,			// Reg 07: Digital Audio Interface Format (msb, 16-bit, slave, I2S)
+	0x00A,			// Reg 07: Digital Audio Interface Format (msb, 24-bit, slave, I2S)
 	0x000,			// Reg 08: Sampling Control (Normal, 256x, 48k ADC/DAC)
 	0x001			// Reg 09: Active Control
 };
@@ -131,6 +131,43 @@ int32_t WM8731_Reset(void)
 	return result;
 }
 
+/*
+ * set WM8731 sample rate - MCLK must already be 256x the new rate
+ * In normal mode with SR = 0000 the codec runs at MCLK/256 for any rate up
+ * to 48kHz. 96kHz needs the 128x mode so MCLK is halved internally.
+ */
+int32_t WM8731_SetRate(uint32_t rate)
+{
+	uint16_t smpl;
+	int32_t result = 0;
+	
+	switch(rate)
+	{
+		case 32000:
+		case 44100:
+		case 48000:
+			smpl = 0x000;	// Normal, 256x, CLKIDIV2 off
+			break;
+		
+		case 96000:
+			smpl = 0x05C;	// Normal, SR = 0111, CLKIDIV2 on
+			break;
+		
+		default:
+			return -1;
+	}
+	
+	/* sampling control should only be changed while inactive */
+	if(WM8731_WriteRegister((W8731_ADDR_0), REG_ACT, 0x000))
+		result++;
+	if(WM8731_WriteRegister((W8731_ADDR_0), REG_SMPL, smpl))
+		result++;
+	if(WM8731_WriteRegister((W8731_ADDR_0), REG_ACT, 0x001))
+		result++;
+	
+	return result;
+}
+
 /*
  * mute/unmute the WM8731 outputs
  */
@@ -8,6 +8,7 @@
 
 int32_t WM8731_Init(void);
 int32_t WM8731_Reset(void);
+int32_t WM8731_SetRate(uint32_t rate);
 void WM8731_Mute(uint8_t enable);
 void WM8731_HPVol(uint8_t vol);
 void WM8731_InSrc(uint8_t src);